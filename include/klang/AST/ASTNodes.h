@@ -22,6 +22,8 @@
 
 namespace klang {
 
+  class CompilerInstance;
+
   //===--------------------------------------------------------------------===//
   // Abstract Syntax Tree (aka Parse Tree)
   //===--------------------------------------------------------------------===//
@@ -49,7 +51,14 @@ namespace klang {
 
 		ExprAST(ExprKind K) : Kind(K) {}
     virtual ~ExprAST() {}
-    virtual llvm::Value *Codegen() = 0;
+    virtual llvm::Value *Codegen(CompilerInstance &CI) = 0;
+
+    /// markTailCalls - Mark the calls to Name whose value is the value of
+    /// this expression.  Returns true if there is any.
+    virtual bool markTailCalls(const std::string &Name) { return false; }
+
+    /// assignsTo - Whether this expression may assign to the variable Name.
+    virtual bool assignsTo(const std::string &Name) const { return false; }
   };
 
   /// NumberExprAST - Expression class for numeric literals like "1.0".
@@ -58,11 +67,13 @@ namespace klang {
   public:
     NumberExprAST(double val) : ExprAST(EK_Number), Val(val) {}
 
+    double getValue() const { return Val; }
+
 		static bool classof(const ExprAST *E) {
 			return E->getKind() == EK_Number;
 		}
 
-    virtual llvm::Value *Codegen();
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
   };
 
   /// VariableExprAST - Expression class for referencing a variable, like "a".
@@ -76,7 +87,7 @@ namespace klang {
 		}
 
     const std::string &getName() const { return Name; }
-    virtual llvm::Value *Codegen();
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
   };
 
   /// UnaryExprAST - Expression class for a unary operator.
@@ -86,12 +97,16 @@ namespace klang {
   public:
     UnaryExprAST(char opcode, ExprAST *operand)
       : ExprAST(EK_Unary), Opcode(opcode), Operand(operand) {}
+    virtual ~UnaryExprAST() { delete Operand; }
 
 		static bool classof(const ExprAST *E) {
 			return E->getKind() == EK_Unary;
 		}
 
-    virtual llvm::Value *Codegen();
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
+    virtual bool assignsTo(const std::string &Name) const {
+      return Operand->assignsTo(Name);
+    }
   };
 
   /// BinaryExprAST - Expression class for a binary operator.
@@ -101,27 +116,43 @@ namespace klang {
   public:
     BinaryExprAST(char op, ExprAST *lhs, ExprAST *rhs)
       : ExprAST(EK_Binary), Op(op), LHS(lhs), RHS(rhs) {}
+    virtual ~BinaryExprAST() { delete LHS; delete RHS; }
 
 		static bool classof(const ExprAST *E) {
 			return E->getKind() == EK_Binary;
 		}
 
-    virtual llvm::Value *Codegen();
+    char getOpcode() const { return Op; }
+    ExprAST *getLHS() const { return LHS; }
+    ExprAST *getRHS() const { return RHS; }
+
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
+    virtual bool assignsTo(const std::string &Name) const;
   };
 
   /// CallExprAST - Expression class for function calls.
   class CallExprAST : public ExprAST {
     std::string Callee;
     std::vector<ExprAST*> Args;
+
+    /// TailRecursive - Whether this call is a call of the function being
+    /// defined in tail position, which is generated as a jump.
+    bool TailRecursive;
   public:
     CallExprAST(const std::string &callee, std::vector<ExprAST*> &args)
-      : ExprAST(EK_Call), Callee(callee), Args(args) {}
+      : ExprAST(EK_Call), Callee(callee), Args(args), TailRecursive(false) {}
+    virtual ~CallExprAST() {
+      for (unsigned i = 0, e = Args.size(); i != e; ++i)
+        delete Args[i];
+    }
 
 		static bool classof(const ExprAST *E) {
 			return E->getKind() == EK_Call;
 		}
 
-    virtual llvm::Value *Codegen();
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
+    virtual bool markTailCalls(const std::string &Name);
+    virtual bool assignsTo(const std::string &Name) const;
   };
 
   /// IfExprAST - Expression class for if/then/else.
@@ -130,12 +161,18 @@ namespace klang {
   public:
     IfExprAST(ExprAST *cond, ExprAST *then, ExprAST *_else)
       : ExprAST(EK_If), Cond(cond), Then(then), Else(_else) {}
+    virtual ~IfExprAST() { delete Cond; delete Then; delete Else; }
 
 		static bool classof(const ExprAST *E) {
 			return E->getKind() == EK_If;
 		}
 
-    virtual llvm::Value *Codegen();
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
+    virtual bool markTailCalls(const std::string &Name);
+    virtual bool assignsTo(const std::string &Name) const {
+      return Cond->assignsTo(Name) || Then->assignsTo(Name) ||
+             Else->assignsTo(Name);
+    }
   };
 
   /// ForExprAST - Expression class for for/in.
@@ -146,12 +183,24 @@ namespace klang {
     ForExprAST(const std::string &varname, ExprAST *start, ExprAST *end,
                ExprAST *step, ExprAST *body)
       : ExprAST(EK_For), VarName(varname), Start(start), End(end), Step(step), Body(body) {}
+    virtual ~ForExprAST() {
+      delete Start;
+      delete End;
+      delete Step;
+      delete Body;
+    }
 
 		static bool classof(const ExprAST *E) {
 			return E->getKind() == EK_For;
 		}
 
-    virtual llvm::Value *Codegen();
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
+    virtual bool assignsTo(const std::string &Name) const;
+
+    /// isBounded - Whether the loop is known to stop: it counts up from a
+    /// constant by a constant step, below a constant bound, and its body
+    /// leaves the variable alone.
+    bool isBounded() const;
   };
 
 
@@ -163,12 +212,21 @@ namespace klang {
     VarExprAST(const std::vector<std::pair<std::string, ExprAST*> > &varnames,
                ExprAST *body)
       : ExprAST(EK_Var), VarNames(varnames), Body(body) {}
+    virtual ~VarExprAST() {
+      for (unsigned i = 0, e = VarNames.size(); i != e; ++i)
+        delete VarNames[i].second;
+      delete Body;
+    }
 
 		static bool classof(const ExprAST *E) {
 			return E->getKind() == EK_Var;
 		}
 
-    virtual llvm::Value *Codegen();
+    virtual llvm::Value *Codegen(CompilerInstance &CI);
+    virtual bool markTailCalls(const std::string &Name) {
+      return Body->markTailCalls(Name);
+    }
+    virtual bool assignsTo(const std::string &Name) const;
   };
 
 
@@ -186,6 +244,8 @@ namespace klang {
                  bool isoperator = false, unsigned prec = 0)
       : Name(name), Args(args), isOperator(isoperator), Precedence(prec) {}
 
+    const std::string &getName() const { return Name; }
+
     bool isUnaryOp() const { return isOperator && Args.size() == 1; }
     bool isBinaryOp() const { return isOperator && Args.size() == 2; }
 
@@ -196,9 +256,11 @@ namespace klang {
 
     unsigned getBinaryPrecedence() const { return Precedence; }
 
-    llvm::Function *Codegen();
+    llvm::Function *Codegen(CompilerInstance &CI);
 
-    void CreateArgumentAllocas(llvm::Function *F);
+    bool CheckRedefinition(CompilerInstance &CI) const;
+
+    void CreateArgumentAllocas(CompilerInstance &CI, llvm::Function *F);
   };
 
   /// FunctionAST - This class represents a function definition itself.
@@ -208,7 +270,11 @@ namespace klang {
   public:
     FunctionAST(PrototypeAST *proto, ExprAST *body)
       : Proto(proto), Body(body) {}
-    llvm::Function *Codegen();
+
+    /// The prototype of a definition stays in FunctionProtos, so only
+    /// one-shot top-level expressions are ever deleted.
+    ~FunctionAST() { delete Proto; delete Body; }
+    llvm::Function *Codegen(CompilerInstance &CI);
 
   };
 
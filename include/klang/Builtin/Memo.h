@@ -0,0 +1,38 @@
+//===--- Memo.h - -----------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines the memo tables of memoized functions.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_MEMO_H
+#define KLANG_MEMO_H
+
+//===----------------------------------------------------------------------===//
+// Runtime support for functions compiled with -memoize.
+//===----------------------------------------------------------------------===//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  /// klang_memo_lookup - Look the NumArgs arguments at Args up in the memo
+  /// table at *Table, which is created on first use.  Return 1 and set
+  /// *Result if they were seen before, and 0 otherwise.
+  int klang_memo_lookup(void **Table, const double *Args, unsigned NumArgs,
+                        double *Result);
+
+  /// klang_memo_store - Record Result for the arguments at Args, evicting
+  /// whatever the table held in their place.
+  void klang_memo_store(void **Table, const double *Args, unsigned NumArgs,
+                        double Result);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,57 @@
+//===--- BackendUtil.h - ----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file declares the ahead-of-time code generation helpers.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_BACKENDUTIL_H
+#define KLANG_BACKENDUTIL_H
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Function;
+  class Module;
+  class TargetMachine;
+  class raw_ostream;
+}
+
+namespace klang {
+
+  /// BackendAction - What EmitBackendOutput produces from a module.
+  enum BackendAction {
+    Backend_EmitAssembly, ///< Emit native assembly.
+    Backend_EmitBC,       ///< Emit LLVM bitcode.
+    Backend_EmitLL,       ///< Emit human-readable LLVM assembly.
+    Backend_EmitNothing,  ///< Don't emit anything.
+    Backend_EmitObj       ///< Emit a native object file.
+  };
+
+  /// CreateHostTargetMachine - Create a target machine for the host, to
+  /// compile programs ahead of time.  Returns null and sets ErrStr on failure.
+  llvm::TargetMachine *CreateHostTargetMachine(std::string &ErrStr);
+
+  /// EmitMainFunction - Add a 'main' to M that runs the top-level expressions
+  /// Exprs in order.  A declaration of 'main' is defined in place.  Returns
+  /// null and sets ErrStr if M already defines 'main', or calls it.
+  llvm::Function *EmitMainFunction(llvm::Module *M,
+                                   const std::vector<llvm::Function*> &Exprs,
+                                   std::string &ErrStr);
+
+  /// EmitBackendOutput - Write M to OS as IR, or lower it through TM first.
+  /// Returns false and sets ErrStr on failure.
+  bool EmitBackendOutput(llvm::Module *M, llvm::TargetMachine &TM,
+                         BackendAction Action, llvm::raw_ostream &OS,
+                         std::string &ErrStr);
+}
+
+#endif //#ifndef KLANG_BACKENDUTIL_H
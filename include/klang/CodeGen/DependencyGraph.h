@@ -0,0 +1,95 @@
+//===--- DependencyGraph.h - ------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines the DependencyGraph class.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_DEPENDENCYGRAPH_H
+#define KLANG_DEPENDENCYGRAPH_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Function;
+  class raw_ostream;
+}
+
+namespace klang {
+
+  class OptimizationCache;
+
+  /// DependencyGraph - Which functions each function calls, for caching
+  /// code optimized across function boundaries.
+  ///
+  /// Once the module pipeline inlines callee bodies, the optimized code of a
+  /// function depends on more than its own IR.  Its key in the graph also
+  /// covers the key of every callee, so an edited function invalidates the
+  /// cached code of its dependents and of nothing else.  A body that uses a
+  /// user-defined binary operator relied on its precedence when it was
+  /// parsed; the precedence is part of the edge to the operator.
+  ///
+  /// The graph is saved next to the optimization cache, so that a later run can
+  /// tell which functions were edited and which were recompiled only for a
+  /// dependency.  It only serves the JIT: a whole program is optimized as one
+  /// module, so only its per-function pipeline is cached.
+  class DependencyGraph {
+    /// Node - A function the last time it was compiled.
+    struct Node {
+      /// OwnKey - The cache key of the function on its own.
+      std::string OwnKey;
+      /// Key - OwnKey combined with the keys of the callees.
+      std::string Key;
+      std::vector<std::string> Callees;
+    };
+
+    llvm::StringMap<Node> Nodes;
+
+    /// Previous - The graph of the last run, as loaded.
+    llvm::StringMap<Node> Previous;
+
+    unsigned Unchanged;
+    unsigned Changed;
+    unsigned Invalidated;
+    unsigned Added;
+
+    static void writeNode(llvm::raw_ostream &OS, llvm::StringRef Name,
+                          const Node &N);
+
+  public:
+    DependencyGraph();
+
+    /// addFunction - Record F, before the module pipeline runs over it, and
+    /// return the key its optimized code is cached under.  BinopPrecedence
+    /// is the precedence table the body was parsed with.
+    std::string addFunction(llvm::Function *F,
+                            const OptimizationCache &Cache,
+                            const std::map<char, int> &BinopPrecedence);
+
+    /// load - Read the graph of the last run from Path.  A missing or bad
+    /// file leaves the graph empty.
+    void load(llvm::StringRef Path);
+
+    /// save - Write the graph to Path, with the nodes of the last run that
+    /// were not compiled this time.  Failures are ignored.
+    void save(llvm::StringRef Path) const;
+
+    /// printStats - Print how many functions were unchanged, edited,
+    /// recompiled for a dependency, and new.
+    void printStats(llvm::raw_ostream &OS) const;
+  };
+
+}
+
+#endif //#ifndef KLANG_DEPENDENCYGRAPH_H
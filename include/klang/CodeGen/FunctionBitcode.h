@@ -0,0 +1,38 @@
+//===--- FunctionBitcode.h - ------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file declares the bitcode form of a single function.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_FUNCTIONBITCODE_H
+#define KLANG_FUNCTIONBITCODE_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
+namespace llvm {
+  class Function;
+}
+
+namespace klang {
+
+  /// WriteFunctionBitcode - Return the bitcode of a module that holds the
+  /// body of F and declarations of everything it refers to.
+  std::string WriteFunctionBitcode(llvm::Function *F);
+
+  /// ReadFunctionBitcode - Replace the body of F, if any, with the one stored
+  /// in Bitcode by WriteFunctionBitcode.  The values the body refers to are
+  /// looked up by name in the module of F, and declared there if missing.
+  /// Returns false, leaving F alone, if Bitcode cannot be read.
+  bool ReadFunctionBitcode(llvm::Function *F, llvm::StringRef Bitcode);
+}
+
+#endif //#ifndef KLANG_FUNCTIONBITCODE_H
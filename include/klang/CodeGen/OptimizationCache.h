@@ -0,0 +1,80 @@
+//===--- OptimizationCache.h - ----------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines the OptimizationCache class.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_OPTIMIZATIONCACHE_H
+#define KLANG_OPTIMIZATIONCACHE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Atomic.h"
+#include <string>
+
+namespace llvm {
+  class Function;
+  class raw_ostream;
+}
+
+namespace klang {
+
+  /// OptimizationCache - A persistent cache of optimized functions.
+  ///
+  /// The key of a function is a 128-bit hash of its unoptimized IR, the
+  /// declarations of its module, and a context string naming the
+  /// optimization pipeline and the target.  The optimized function is stored
+  /// as bitcode in a file named after the key, so a later run that generates
+  /// the same IR skips the optimizer.  Instruction selection and machine
+  /// code emission still run on every hit: the JIT of this LLVM cannot load
+  /// object code.
+  ///
+  /// Compilations on separate threads may share one cache.
+  class OptimizationCache {
+    std::string Dir;
+    std::string Context;
+
+    volatile llvm::sys::cas_flag Hits;
+    volatile llvm::sys::cas_flag Misses;
+    volatile llvm::sys::cas_flag Stores;
+
+    std::string getPath(llvm::StringRef Key) const;
+
+  public:
+    /// OptimizationCache - Cache into Dir, which is created when missing.
+    /// Context must change whenever the same IR would be optimized
+    /// differently.
+    OptimizationCache(llvm::StringRef Dir, llvm::StringRef Context);
+
+    /// getKey - Return the cache key of the unoptimized function F.
+    std::string getKey(llvm::Function *F) const;
+
+    /// hashKey - Return a cache key for Data, which names everything the
+    /// cached result depends on besides the context.
+    std::string hashKey(llvm::StringRef Data) const;
+
+    /// hashData - Return the hash of Data in hex, without the context.
+    static std::string hashData(llvm::StringRef Data);
+
+    /// load - Replace the body of F with the cached one for Key.  Returns
+    /// false, leaving F alone, on a miss.
+    bool load(llvm::StringRef Key, llvm::Function *F);
+
+    /// store - Cache the optimized function F under Key.  Failures to write
+    /// are ignored: the cache is only an accelerator.
+    void store(llvm::StringRef Key, llvm::Function *F);
+
+    /// printStats - Print the hit, miss and store counts.
+    void printStats(llvm::raw_ostream &OS) const;
+  };
+
+}
+
+#endif //#ifndef KLANG_OPTIMIZATIONCACHE_H
@@ -0,0 +1,86 @@
+//===--- ParallelOptimizer.h - ----------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines the ParallelOptimizer class.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_PARALLELOPTIMIZER_H
+#define KLANG_PARALLELOPTIMIZER_H
+
+#include <deque>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Function;
+}
+
+namespace klang {
+
+  class CompilerInstance;
+  class OptimizationCache;
+
+  /// ParallelOptimizer - Runs the function pipeline on a pool of threads.
+  ///
+  /// An LLVM context must only be used by one thread at a time, so each
+  /// worker has a context of its own.  A function travels to a worker as
+  /// bitcode, is optimized there, and travels back the same way.  Its body
+  /// in the program stays unoptimized until join, which must run before the
+  /// program is JIT-compiled or emitted.
+  class ParallelOptimizer {
+    /// Job - Optimize the function in Bitcode, in place.  Key is the cache
+    /// key of F, or empty.
+    struct Job {
+      llvm::Function *F;
+      std::string Key;
+      std::string Bitcode;
+      bool Failed;
+    };
+
+    const CompilerInstance &CI;
+    OptimizationCache *Cache;
+
+    /// Jobs - Every job since the last join, in submission order.
+    std::vector<Job*> Jobs;
+    std::deque<Job*> Queue;
+    unsigned Pending;
+
+    std::vector<pthread_t> Threads;
+    pthread_mutex_t Lock;
+    pthread_cond_t WorkCond;
+    pthread_cond_t DoneCond;
+    bool Running;
+
+    static void *ThreadMain(void *Arg);
+    void run();
+    void optimize(Job &J) const;
+
+  public:
+    /// ParallelOptimizer - Start NumThreads workers, which run the function
+    /// pipeline of CI.  Optimized functions are stored into Cache, if not
+    /// null, at join.
+    ParallelOptimizer(const CompilerInstance &CI, unsigned NumThreads,
+                      OptimizationCache *Cache);
+    ~ParallelOptimizer();
+
+    /// enqueue - Optimize F in the background.  F must not change until
+    /// join.
+    void enqueue(llvm::Function *F, const std::string &Key);
+
+    /// join - Wait for every queued function and give each its optimized
+    /// body.  Only the thread that generates the program may call it.
+    void join();
+  };
+
+}
+
+#endif //#ifndef KLANG_PARALLELOPTIMIZER_H
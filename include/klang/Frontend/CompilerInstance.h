@@ -0,0 +1,187 @@
+//===--- CompilerInstance.h - -----------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines the CompilerInstance class.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_COMPILERINSTANCE_H
+#define KLANG_COMPILERINSTANCE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/Mutex.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class AllocaInst;
+  class FunctionPassManager;
+  class Module;
+  class PassManager;
+  class PassManagerBuilder;
+  class TargetMachine;
+}
+
+namespace klang {
+
+  class BackgroundOptimizer;
+  class DependencyGraph;
+  class KlangJIT;
+  class OptimizationCache;
+  class ParallelOptimizer;
+  class PrototypeAST;
+
+  /// CompilerInstance - The state of one compilation.
+  ///
+  /// Everything the parser and the code generator share lives here, along
+  /// with the LLVM context all of it is built in.  Two instances have
+  /// nothing in common, so separate threads may run separate compilations,
+  /// once llvm_start_multithreaded has been called.
+  ///
+  /// The instance does not own the JIT, the target, or the helpers below;
+  /// whoever sets them up must outlive the compilation and tear them down
+  /// before the instance goes, since their IR lives in its context.
+  class CompilerInstance {
+    llvm::LLVMContext Context;
+
+    CompilerInstance(const CompilerInstance &);   // DO NOT IMPLEMENT
+    void operator=(const CompilerInstance &);     // DO NOT IMPLEMENT
+
+    void configurePassManagerBuilder(llvm::PassManagerBuilder &PMB) const;
+
+  public:
+    /// CompilerInstance - Create an instance with the standard binary
+    /// operators installed and no target yet.
+    CompilerInstance();
+    ~CompilerInstance();
+
+    llvm::LLVMContext &getContext() { return Context; }
+
+    llvm::Module *TheModule;
+    llvm::IRBuilder<> Builder;
+    std::map<std::string, llvm::AllocaInst*> NamedValues;
+
+    /// TailHeader - While a function with self-recursive tail calls is being
+    /// generated, the block its body starts in.  The calls store their
+    /// arguments into TailArgs, the argument allocas, and jump back here.
+    llvm::BasicBlock *TailHeader;
+    std::vector<llvm::AllocaInst*> TailArgs;
+
+    /// UnboundedLoop - Set while a function is being generated once it has
+    /// a 'for' loop that is not known to stop.
+    bool UnboundedLoop;
+
+    llvm::FunctionPassManager *TheFPM;
+
+    /// TheJIT - Null when the program is compiled ahead of time.
+    KlangJIT *TheJIT;
+
+    /// WholeProgram - Whether every item goes into one program module that
+    /// is optimized and run, or written out, once the input is parsed.
+    bool WholeProgram;
+
+    /// TheTarget - The machine code is generated for.
+    llvm::TargetMachine *TheTarget;
+
+    /// FunctionProtos - The prototype of every function declared or defined
+    /// so far, by name.
+    std::map<std::string, PrototypeAST*> FunctionProtos;
+
+    /// Libraries - Precompiled modules whose functions may be used without
+    /// a declaration.  Their prototypes are only made on first use, so that
+    /// a large library costs nothing up front.
+    std::vector<llvm::Module*> Libraries;
+
+    /// LibraryBitcode - The bitcode each of Libraries was read from, so that
+    /// another context can read it again.  The memory belongs to the module.
+    std::map<llvm::Module*, llvm::StringRef> LibraryBitcode;
+
+    /// BinopPrecedence - This holds the precedence for each binary operator
+    /// that is defined.
+    std::map<char, int> BinopPrecedence;
+
+    /// PureFunctions - The functions defined so far that are known to have
+    /// no side effects: they call nothing but themselves and each other.
+    std::set<std::string> PureFunctions;
+
+    /// TerminatingFunctions - The pure functions that are also known to
+    /// return: their loops count to a constant bound and they do not recurse.
+    /// Only these are marked readnone, since the optimizer may delete an
+    /// unused call to one.
+    std::set<std::string> TerminatingFunctions;
+
+    /// Memoize - Whether pure functions remember their results.
+    bool Memoize;
+
+    /// TheOptimizer - Non-null under tiered execution.
+    BackgroundOptimizer *TheOptimizer;
+
+    /// TheCache - Non-null when optimized functions are cached on disk.
+    OptimizationCache *TheCache;
+
+    /// TheDeps - Non-null when code optimized across functions is cached
+    /// as well.  Used along with TheCache.
+    DependencyGraph *TheDeps;
+
+    /// TheParallelOptimizer - Non-null when a whole program is optimized on
+    /// a pool of threads.
+    ParallelOptimizer *TheParallelOptimizer;
+
+    /// CompilerLock - Serializes every use of the IR and the JIT between the
+    /// parser and the background optimizer.
+    llvm::sys::Mutex CompilerLock;
+
+    /// OptLevel - The -O level, or -1 for the function pipeline of the
+    /// tutorial and no module pipeline.
+    int OptLevel;
+
+    /// getPrototype - Return the prototype of the function Name, declared or
+    /// defined so far or found in Libraries, or null.
+    PrototypeAST *getPrototype(const std::string &Name);
+
+    /// createFunctionPassManager - Create the optimization pipeline for the
+    /// functions of M.  Only TheTarget and OptLevel are read, so worker
+    /// threads may call it for modules of their own context.
+    llvm::FunctionPassManager *createFunctionPassManager(llvm::Module *M) const;
+
+    /// createTierPassManager - Create the pipeline the background optimizer
+    /// runs over hot functions.  With -O, this is the per-function part of
+    /// the -O pipeline in full, since no module pipeline follows.
+    llvm::FunctionPassManager *createTierPassManager(llvm::Module *M) const;
+
+    /// createModulePassManager - Create the interprocedural pipeline of
+    /// OptLevel, or return null if there is none.
+    llvm::PassManager *createModulePassManager() const;
+
+    /// optimizeModule - Run the module pipeline over M.  In the JIT, the
+    /// functions of earlier items are inlinable too.  Functions found in the
+    /// cache are restored from it and kept out of the pipeline.
+    void optimizeModule(llvm::Module *M);
+
+    /// optimizeProgram - Run the whole-program pipeline over M.  Every
+    /// function but EntryPoints is internalized first, so that unused ones
+    /// go and the others are free to change; those left use the fast
+    /// calling convention.
+    void optimizeProgram(llvm::Module *M,
+                         const std::vector<const char*> &EntryPoints);
+
+    /// initializeModuleAndPassManager - Open a fresh TheModule for the next
+    /// top-level item, along with its TheFPM.  In whole-program mode every
+    /// item goes into the first TheModule.
+    void initializeModuleAndPassManager();
+  };
+
+}
+
+#endif //#ifndef KLANG_COMPILERINSTANCE_H
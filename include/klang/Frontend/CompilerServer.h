@@ -0,0 +1,45 @@
+//===--- CompilerServer.h - -------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file declares the compiler server and its client.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_COMPILERSERVER_H
+#define KLANG_COMPILERSERVER_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
+namespace klang {
+
+  class CompilerInstance;
+
+  /// RunServer - Serve the programs sent to the Unix socket SocketPath with
+  /// CI, which is set up for the JIT and has compiled any preludes already.
+  ///
+  /// Each connection is served by a child forked from the server, so that
+  /// it starts out with the target initialized, the JIT constructed and the
+  /// preludes compiled, and leaves nothing behind.  The child reads the
+  /// program until the client shuts down its end, then runs it with both
+  /// output streams going back over the connection.
+  ///
+  /// Only returns, with ErrStr set, if the socket cannot be set up.
+  void RunServer(CompilerInstance &CI, llvm::StringRef SocketPath,
+                 std::string &ErrStr);
+
+  /// RunClient - Send Source to the server at SocketPath and copy what it
+  /// prints to standard output.  Returns false and sets ErrStr if there is
+  /// no server to talk to.
+  bool RunClient(llvm::StringRef SocketPath, llvm::StringRef Source,
+                 std::string &ErrStr);
+}
+
+#endif //#ifndef KLANG_COMPILERSERVER_H
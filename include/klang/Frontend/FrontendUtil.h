@@ -0,0 +1,46 @@
+//===--- FrontendUtil.h - ---------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines helpers for running compilations.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_FRONTENDUTIL_H
+#define KLANG_FRONTENDUTIL_H
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Function;
+  class MemoryBuffer;
+}
+
+namespace klang {
+
+  class CompilerInstance;
+
+  /// CompileFiles - Compile each of Inputs on a thread of its own, into the
+  /// program module of a compiler instance of its own with the target,
+  /// -O level and cache of CI.  The modules are then linked, in order, into
+  /// the program module of CI, which resolves the declarations of each file
+  /// to the definitions of the others.
+  ///
+  /// Like a C translation unit, a file only sees its own items: it declares
+  /// what it uses from other files with 'extern'.  The top-level expressions
+  /// of all files are appended to Exprs in order.  Returns false and sets
+  /// ErrStr if the modules do not link.
+  bool CompileFiles(CompilerInstance &CI,
+                    const std::vector<llvm::MemoryBuffer*> &Inputs,
+                    std::vector<llvm::Function*> &Exprs,
+                    std::string &ErrStr);
+}
+
+#endif //#ifndef KLANG_FRONTENDUTIL_H
@@ -0,0 +1,53 @@
+//===--- Prelude.h - --------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file declares the reading and writing of precompiled preludes.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_PRELUDE_H
+#define KLANG_PRELUDE_H
+
+#include <string>
+
+namespace llvm {
+  class MemoryBuffer;
+  class Module;
+}
+
+namespace klang {
+
+  class CompilerInstance;
+
+  /// RecordOperators - Record in M the precedence of every binary operator
+  /// M defines, as the named metadata "klang.operators", so that a prelude
+  /// compiled from M can install the operators without its source.
+  void RecordOperators(const CompilerInstance &CI, llvm::Module *M);
+
+  /// RecordPurity - Record in M which of the functions M defines are pure,
+  /// and which are known to return, as the named metadata "klang.pure" and
+  /// "klang.terminating", so that programs using a prelude compiled from M
+  /// can still mark calls to them readnone.
+  void RecordPurity(const CompilerInstance &CI, llvm::Module *M);
+
+  /// LoadPrelude - Read the bitcode of a prelude in the context of CI, add
+  /// it to the libraries of CI and install its operators and what is known
+  /// of the purity of its functions.  Only the module
+  /// header is read: a function body is read once it is needed, and its
+  /// prototype made once it is used, so loading costs the same whatever the
+  /// size of the prelude.
+  ///
+  /// Takes ownership of Buffer.  Returns the module of the prelude, for the
+  /// JIT or for linking into the program, or null with ErrStr set.
+  llvm::Module *LoadPrelude(CompilerInstance &CI, llvm::MemoryBuffer *Buffer,
+                            std::string &ErrStr);
+}
+
+#endif //#ifndef KLANG_PRELUDE_H
@@ -0,0 +1,138 @@
+//===--- BackgroundOptimizer.h - --------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines the BackgroundOptimizer class.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_BACKGROUNDOPTIMIZER_H
+#define KLANG_BACKGROUNDOPTIMIZER_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include <deque>
+#include <pthread.h>
+#include <vector>
+
+namespace llvm {
+  class BasicBlock;
+  class Function;
+  class GlobalVariable;
+  class Module;
+}
+
+namespace klang {
+
+  class CompilerInstance;
+  class KlangJIT;
+
+  /// BackgroundOptimizer - Drives tiered execution.
+  ///
+  /// Every function is first JIT-compiled without IR optimization and with
+  /// fast instruction selection, so that execution can start at once.  Callers
+  /// reach a function through its call slot, a global holding the address of
+  /// the current body.  A worker thread then optimizes a copy of the function,
+  /// compiles it, and atomically stores the new address into the slot.
+  ///
+  /// A frame that is already running the quick body would never see the new
+  /// slot value, so every 'for' loop header also gets an on-stack replacement
+  /// check.  Once the optimized continuation of the loop is ready, the next
+  /// iteration calls it with the current variables and returns its result.
+  ///
+  /// The LLVM context is not thread safe, so the worker holds CompilerLock
+  /// while it touches IR or the JIT.  Native code runs without the lock, but
+  /// may compile a callee on its first call, so the worker holds the lock of
+  /// the JIT as well.
+  class BackgroundOptimizer {
+    CompilerInstance &CI;
+    KlangJIT &JIT;
+
+    /// DefaultFastISel - Whether the target used fast instruction selection
+    /// before tiering took over the flag.
+    bool DefaultFastISel;
+
+    /// Slots - The call slot of every function compiled in the quick tier,
+    /// by function name.  Each slot lives in the module of its function.
+    llvm::StringMap<llvm::GlobalVariable*> Slots;
+
+    /// LoopHeaders - The 'for' loop headers of the function being generated.
+    std::vector<llvm::BasicBlock*> LoopHeaders;
+
+    /// OSRSlots - The storage of the on-stack replacement slots, by module.
+    /// It is ours rather than the JIT's, so that it goes with its module.
+    llvm::DenseMap<llvm::Module*, std::vector<void**> > OSRSlots;
+
+    /// Job - Optimize Body, compile it and publish its address in Target.
+    struct Job {
+      llvm::Function *Body;
+      void *volatile *Target;
+    };
+
+    std::deque<Job> Queue;
+    pthread_mutex_t QueueLock;
+    pthread_cond_t QueueCond;
+    pthread_t Thread;
+    bool Running;
+
+    static void *ThreadMain(void *Arg);
+    void run();
+    bool takeJob(Job &J);
+    void optimize(const Job &J);
+    void enqueue(llvm::Function *Body, void *volatile *Target);
+
+    /// dropJobs - Drop the queued jobs that would publish into Target.
+    void dropJobs(void *volatile *Target);
+
+  public:
+    /// BackgroundOptimizer - Drive tiered execution for CI, which must have
+    /// a JIT.
+    explicit BackgroundOptimizer(CompilerInstance &CI);
+    ~BackgroundOptimizer();
+
+    /// start - Spawn the worker thread.
+    void start();
+
+    /// stop - Drop pending work and join the worker thread.
+    void stop();
+
+    /// createSlot - Create the call slot for F, or declare the slot of the
+    /// earlier definition F replaces.  This must happen before the body of F
+    /// is generated so that recursive calls can use the slot.
+    llvm::GlobalVariable *createSlot(llvm::Function *F);
+
+    /// getSlot - Return the call slot for F, or null if F has none.  If F is
+    /// defined by an earlier item, the slot is declared in the module of F.
+    llvm::GlobalVariable *getSlot(llvm::Function *F);
+
+    /// addLoopHeader - Record the header of a 'for' loop as an on-stack
+    /// replacement point of the function being generated.
+    void addLoopHeader(llvm::BasicBlock *Header) {
+      LoopHeaders.push_back(Header);
+    }
+
+    /// forgetFunction - Drop the slot and loop headers of F, whose body
+    /// failed to generate.
+    void forgetFunction(llvm::Function *F);
+
+    /// addFunction - Compile F in the quick tier with on-stack replacement
+    /// checks at its loop headers, point its slot at the result and queue an
+    /// optimized copy and the loop continuations for the worker thread.  The
+    /// module of F must already be in the JIT.
+    void addFunction(llvm::Function *F);
+
+    /// forgetModule - Drop the queued work on the functions of M, which is
+    /// about to be removed from the JIT, and free its on-stack replacement
+    /// slots.  The caller must hold CompilerLock.
+    void forgetModule(llvm::Module *M);
+  };
+
+}
+
+#endif //#ifndef KLANG_BACKGROUNDOPTIMIZER_H
@@ -0,0 +1,206 @@
+//===--- KlangJIT.h - -------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines the KlangJIT class.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_KLANGJIT_H
+#define KLANG_KLANGJIT_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Support/Mutex.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class DataLayout;
+  class Function;
+  class GlobalValue;
+  class GlobalVariable;
+  class LLVMContext;
+  class Module;
+  class TargetMachine;
+}
+
+namespace klang {
+
+  /// KlangJIT - The execution layer.
+  ///
+  /// Every top-level item is generated into a module of its own and handed
+  /// over here.  The layering follows the ORC design of later LLVM releases,
+  /// built on the legacy JIT of this one:
+  ///
+  ///  - Modules are compiled lazily.  A function is compiled the first time it
+  ///    is called, through a compile-on-call stub.
+  ///  - A symbol table links each declaration to the definition of its name
+  ///    in another module, so modules never have to be merged.
+  ///  - removeModule frees both the machine code and the IR of a module.
+  ///  - With setRedefinable, later modules call a function through its call
+  ///    stub, which a new definition of its name takes over.
+  ///
+  /// With setDiscardIR, the body of a function is deleted once its machine
+  /// code has been emitted.  Only a bitcode summary is kept, from which
+  /// rematerialize restores the body when the IR is needed again.
+  class KlangJIT {
+    class EmissionListener;
+
+    llvm::OwningPtr<llvm::ExecutionEngine> EE;
+    llvm::TargetMachine &TM;
+    llvm::OwningPtr<EmissionListener> Listener;
+
+    /// Symbols - The definitions visible to other modules.  A newer
+    /// definition of a name hides the older one.
+    llvm::StringMap<llvm::GlobalValue*> Symbols;
+
+    /// Libraries - Modules whose definitions are only looked up when no
+    /// other module defines the name.
+    std::vector<llvm::Module*> Libraries;
+
+    /// Unresolved - Declarations waiting for a definition of their name.
+    llvm::StringMap<std::vector<llvm::GlobalValue*> > Unresolved;
+
+    /// Stubs - The call stub of every function defined so far, by name: a
+    /// global holding the address of the current definition of the name.
+    /// Each stub lives in the module of the first definition, or in
+    /// StubModule if an extern declared the name first.
+    llvm::StringMap<llvm::GlobalVariable*> Stubs;
+
+    /// StubModule - The module of the stubs of declared functions, created
+    /// with the first of them.  The execution engine owns it.
+    llvm::Module *StubModule;
+
+    /// Redefinable - Whether functions added from now on get call stubs.
+    bool Redefinable;
+
+    /// DiscardIR - Whether function bodies are deleted after emission.
+    bool DiscardIR;
+
+    /// Emitted - Functions whose body can go, filled in by the listener.
+    std::vector<llvm::Function*> Emitted;
+    llvm::sys::Mutex EmittedLock;
+
+    /// Summaries - The bitcode of every function whose body was deleted.
+    llvm::DenseMap<const llvm::Function*, std::string> Summaries;
+
+    KlangJIT(llvm::ExecutionEngine *EE, llvm::TargetMachine &TM);
+
+    void link(llvm::GlobalValue *Decl);
+    void define(llvm::GlobalValue *Def);
+    void resolve(llvm::GlobalValue *Decl, llvm::GlobalValue *Def);
+    void forget(llvm::GlobalValue *GV);
+    void discardEmittedIR();
+
+  public:
+    typedef llvm::Module *ModuleHandle;
+
+    /// create - Create a JIT for the native target, for modules of Context.
+    /// Returns null and sets ErrStr on failure.
+    static KlangJIT *create(llvm::LLVMContext &Context, std::string &ErrStr);
+    ~KlangJIT();
+
+    llvm::TargetMachine &getTargetMachine() { return TM; }
+
+    /// getLock - The lock the JIT holds while it compiles, including when a
+    /// compile-on-call stub runs in JIT-ed code.  Whoever else touches the IR
+    /// while JIT-ed code may be running must hold it too.
+    llvm::sys::Mutex &getLock() { return EE->lock; }
+    const llvm::DataLayout *getDataLayout() const {
+      return EE->getDataLayout();
+    }
+
+    /// addModule - Take ownership of M.  Nothing is compiled yet.
+    ModuleHandle addModule(llvm::Module *M);
+
+    /// addLibrary - Take ownership of M, whose definitions are looked up by
+    /// name only when needed.  Unlike addModule, this does not publish or
+    /// compile the functions of M, so a lazily read module stays unread; only
+    /// its declarations are linked.
+    void addLibrary(llvm::Module *M);
+
+    /// removeModule - Free the machine code and the IR of a module.  Other
+    /// modules must no longer call into it.
+    void removeModule(ModuleHandle H);
+
+    /// findSymbol - Return the visible definition of Name, or null.
+    llvm::GlobalValue *findSymbol(llvm::StringRef Name) const;
+
+    /// getPointerToFunction - Compile F now, if it is not compiled yet, and
+    /// return its address.
+    void *getPointerToFunction(llvm::Function *F) {
+      return EE->getPointerToFunction(F);
+    }
+
+    /// getPointerToGlobal - Return the address of a global variable.
+    void *getPointerToGlobal(llvm::GlobalVariable *GV) {
+      return EE->getPointerToGlobal(GV);
+    }
+
+    /// mapGlobal - Use the storage at Addr, which the caller owns, for GV.
+    /// This must happen before any code using GV is compiled, and the
+    /// storage must outlive the module of GV.
+    void mapGlobal(llvm::GlobalVariable *GV, void *Addr) {
+      EE->addGlobalMapping(GV, Addr);
+    }
+
+    /// setRedefinable - Give every function added from now on a call stub,
+    /// so that a later module can redefine it.  Calls through a stub cannot
+    /// be inlined.
+    void setRedefinable(bool Redefine) { Redefinable = Redefine; }
+
+    /// isRedefinable - Whether Name has a call stub, so that a definition of
+    /// it replaces the current one.
+    bool isRedefinable(llvm::StringRef Name) const {
+      return Stubs.count(Name);
+    }
+
+    /// getStub - Return the call stub of the name of F, declared in the
+    /// module of F if need be, or null if the name has none.
+    llvm::GlobalVariable *getStub(llvm::Function *F);
+
+    /// declareFunction - Note an extern of Name ahead of its definition.
+    /// With setRedefinable, a name that is neither defined yet nor a symbol
+    /// of the process gets its call stub now, so that the calls made before
+    /// the definition follow later ones too.
+    void declareFunction(llvm::StringRef Name, llvm::LLVMContext &Context);
+
+    /// setDiscardIR - Delete the body of every function once it has been
+    /// compiled.  Bodies go at the next call to addModule or removeModule,
+    /// when no code generator is working on them.
+    void setDiscardIR(bool Discard) { DiscardIR = Discard; }
+
+    /// importBodies - Give every declaration in M whose definition the JIT
+    /// knows a copy of its body, with available_externally linkage, so that
+    /// the inliner can use it.  M must not be added yet.
+    void importBodies(llvm::Module *M);
+
+    /// dropImportedBodies - Turn the bodies importBodies gave to M back into
+    /// declarations.
+    static void dropImportedBodies(llvm::Module *M);
+
+    /// createSnapshot - Return a new module of Context holding the current
+    /// definition of every function the JIT knows by name, to save the
+    /// session.  Calls through call stubs become direct calls again.  The
+    /// functions of libraries are only declared.  The call slots of tiered
+    /// execution are not undone, so no function may have been tiered.
+    llvm::Module *createSnapshot(llvm::LLVMContext &Context);
+
+    /// rematerialize - Restore the body of F from its bitcode summary.
+    /// Returns false if the body of F was never deleted.  The body is deleted
+    /// again along with the next batch of emitted functions.
+    bool rematerialize(llvm::Function *F);
+  };
+
+}
+
+#endif //#ifndef KLANG_KLANGJIT_H
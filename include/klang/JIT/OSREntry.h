@@ -0,0 +1,58 @@
+//===--- OSREntry.h - -------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file defines on-stack replacement entry points.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef KLANG_OSRENTRY_H
+#define KLANG_OSRENTRY_H
+
+#include <vector>
+
+namespace llvm {
+  class BasicBlock;
+  class Function;
+  class GlobalVariable;
+  class Value;
+}
+
+namespace klang {
+
+  /// OSREntry - An entry point into the middle of a function, at the header
+  /// of one of its 'for' loops.
+  struct OSREntry {
+    /// Header - The loop header in the original function.
+    llvm::BasicBlock *Header;
+
+    /// LiveIns - The values the continuation takes as arguments, in order.
+    /// An alloca stands for the variable it holds.
+    std::vector<llvm::Value*> LiveIns;
+
+    /// Continuation - A copy of the original function that starts at Header
+    /// and runs the rest of the function to completion.
+    llvm::Function *Continuation;
+  };
+
+  /// CreateOSRContinuation - Build the continuation of F at the loop header
+  /// Header.  This must run before any OSR check is inserted into F.  Returns
+  /// false if Header starts with a PHI or a value live into it cannot be
+  /// passed as a double.
+  bool CreateOSRContinuation(llvm::Function *F, llvm::BasicBlock *Header,
+                             OSREntry &Entry);
+
+  /// InsertOSRCheck - Make every iteration of the loop at Entry.Header test
+  /// Slot, and once it holds the address of the compiled continuation, call
+  /// it with the current live values and return its result.
+  void InsertOSRCheck(const OSREntry &Entry, llvm::GlobalVariable *Slot);
+
+}
+
+#endif //#ifndef KLANG_OSRENTRY_H
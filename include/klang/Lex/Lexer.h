@@ -16,6 +16,8 @@
 #define KLANG_LEXER_H
 
 #include "klang/Lex/Token.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
 
 #define KLANG_LEXER_EOF 0x1a
 
@@ -26,11 +28,31 @@ namespace klang {
     int LastChar;
 
     llvm::StringRef Buffer;
+
+    /// Index - The position of the next character in Buffer.
+    unsigned Index;
+
+    /// Interactive - Whether Buffer is the last line read from standard
+    /// input rather than the whole input.
+    bool Interactive;
+
+    /// Line - The storage of Buffer when interactive.
+    std::string Line;
+
     int GetCharFromBuffer(void);
 
+    /// ReadLine - Prompt for the next line of standard input and make it
+    /// the buffer.  Returns false at the end of the input.
+    bool ReadLine();
+
   public:
     Lexer(llvm::StringRef _Buffer);
 
+    /// Lexer - Lex standard input a line at a time, prompting for each one,
+    /// for a user at a terminal.  No line is read before a token is needed,
+    /// so an item ending in ';' is handled as soon as it is entered.
+    Lexer();
+
     /// Return the next token from standard input.
     void Lex(Token &Result);
 
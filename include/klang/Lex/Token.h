@@ -32,14 +32,8 @@ namespace klang {
 
 
     /// GetTokPrecedence - Get the precedence of the pending binary operator
-    /// token.
-    int GetTokPrecedence();
-
-  public:
-
-    /// BinopPrecedence - This holds the precedence for each binary operator
-    /// that is defined.
-    static std::map<char, int> BinopPrecedence;
+    /// token, given the precedence of each binary operator that is defined.
+    int GetTokPrecedence(const std::map<char, int> &BinopPrecedence) const;
   };
 
 }
@@ -42,7 +42,11 @@ namespace klang {
       tok_unary = -12,
 
       // var definition
-      tok_var = -13
+      tok_var = -13,
+
+      // short-circuiting logical operators
+      tok_andand = -14,
+      tok_oror = -15
     };
 
   }//namespace tok
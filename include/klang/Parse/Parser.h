@@ -20,19 +20,32 @@
 
 namespace klang {
 
+  class CompilerInstance;
+
   class Parser {
 
+    CompilerInstance &CI;
     Lexer &Lxr;
 
     // Tok - The current token we are peeking ahead.  All parsing methods assume
     // that this is valid.
     Token Tok;
 
+    // TopLevelExprs - The top-level expressions of a whole program, in source
+    // order.
+    std::vector<llvm::Function*> TopLevelExprs;
+
+    /// ReportTiming - Whether to print how long each item took to compile
+    /// and run.
+    bool ReportTiming;
+
   public:
-    Parser(Lexer &_Lxr)
-      : Lxr(_Lxr)
+    Parser(CompilerInstance &_CI, Lexer &_Lxr)
+      : CI(_CI), Lxr(_Lxr), ReportTiming(false)
     {}
 
+    void setReportTiming(bool Report) { ReportTiming = Report; }
+
     int GetNextToken();
 
     ExprAST *ParseIdentifierExpr();
@@ -60,6 +73,10 @@ namespace klang {
     /// top ::= definition | external | expression | ';'
     void Go();
 
+    const std::vector<llvm::Function*> &getTopLevelExprs() const {
+      return TopLevelExprs;
+    }
+
   };
 
 }
@@ -13,16 +13,24 @@
 //===----------------------------------------------------------------------===//
 
 #include "klang/AST/ASTNodes.h"
-#include "klang/Driver/Driver.h"
+#include "klang/CodeGen/OptimizationCache.h"
+#include "klang/CodeGen/ParallelOptimizer.h"
+#include "klang/Frontend/CompilerInstance.h"
 #include "klang/Driver/Utils.h"
+#include "klang/JIT/BackgroundOptimizer.h"
+#include "klang/JIT/KlangJIT.h"
+#include "klang/Lex/TokenKinds.h"
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Support/Casting.h"
+#include <algorithm>
+#include <cmath>
 #include <map>
 
 //===----------------------------------------------------------------------===//
@@ -42,35 +50,147 @@ static llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction,
                                           const std::string &VarName) {
   llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
                    TheFunction->getEntryBlock().begin());
-  return TmpB.CreateAlloca(llvm::Type::getDoubleTy(llvm::getGlobalContext()), 0,
+  return TmpB.CreateAlloca(llvm::Type::getDoubleTy(TheFunction->getContext()),
+                           0,
                            VarName.c_str());
 }
 
-llvm::Value *NumberExprAST::Codegen() {
-  return llvm::ConstantFP::get(llvm::getGlobalContext(), llvm::APFloat(Val));
+/// getFunction - Return the function Name in the current module.  A function
+/// of an earlier top-level item lives in another module, so declare it here
+/// from its prototype.
+static llvm::Function *getFunction(CompilerInstance &CI,
+                                   const std::string &Name) {
+  if (llvm::Function *F = CI.TheModule->getFunction(Name))
+    return F;
+
+  if (PrototypeAST *P = CI.getPrototype(Name))
+    return P->Codegen(CI);
+
+  return 0;
+}
+
+/// IsReadNone - Whether calls to F may be taken for pure computation.  The
+/// optimizer deletes such a call when its value is unused, so F must also be
+/// known to return.  A pure function that is memoized writes its table, so
+/// it is not.
+static bool IsReadNone(CompilerInstance &CI, llvm::Function *F) {
+  return CI.TerminatingFunctions.count(F->getName()) &&
+         !(CI.Memoize && !CI.TheOptimizer && !F->arg_empty());
+}
+
+/// EmitCall - Emit a call to the user function F.  Under tiered execution the
+/// callee is loaded from its call slot, so that the background optimizer can
+/// swap in a faster body while the caller keeps running.  A redefinable
+/// function of an earlier item is likewise loaded from its call stub.
+static llvm::Value *EmitCall(CompilerInstance &CI, llvm::Function *F,
+                             llvm::ArrayRef<llvm::Value*> Args,
+                             const char *Name) {
+  if (CI.TheOptimizer)
+    if (llvm::GlobalVariable *Slot = CI.TheOptimizer->getSlot(F)) {
+      llvm::Value *Callee =
+        CI.Builder.CreateLoad(Slot, F->getName() + ".tier");
+      return CI.Builder.CreateCall(Callee, Args, Name);
+    }
+
+  if (CI.TheJIT && F->isDeclaration())
+    if (llvm::GlobalVariable *Stub = CI.TheJIT->getStub(F)) {
+      llvm::Value *Callee =
+        CI.Builder.CreateLoad(Stub, F->getName() + ".stub");
+      return CI.Builder.CreateCall(Callee, Args, Name);
+    }
+
+  return CI.Builder.CreateCall(F, Args, Name);
 }
 
-llvm::Value *VariableExprAST::Codegen() {
+llvm::Value *NumberExprAST::Codegen(CompilerInstance &CI) {
+  return llvm::ConstantFP::get(CI.getContext(), llvm::APFloat(Val));
+}
+
+llvm::Value *VariableExprAST::Codegen(CompilerInstance &CI) {
   // Look this variable up in the function.
-  llvm::Value *V = NamedValues[Name];
+  llvm::Value *V = CI.NamedValues[Name];
   if (V == 0) return ErrorV("Unknown variable name");
 
   // Load the value.
-  return Builder.CreateLoad(V, Name.c_str());
+  return CI.Builder.CreateLoad(V, Name.c_str());
 }
 
-llvm::Value *UnaryExprAST::Codegen() {
-  llvm::Value *OperandV = Operand->Codegen();
+llvm::Value *UnaryExprAST::Codegen(CompilerInstance &CI) {
+  llvm::Value *OperandV = Operand->Codegen(CI);
   if (OperandV == 0) return 0;
 
-  llvm::Function *F = TheModule->getFunction(std::string("unary")+Opcode);
+  llvm::Function *F = getFunction(CI, std::string("unary")+Opcode);
+
+  // Logical not is builtin, unless the program defines its own.
+  if (F == 0 && Opcode == '!') {
+    llvm::Value *IsZero = CI.Builder.CreateFCmpOEQ(
+      OperandV,
+      llvm::ConstantFP::get(CI.getContext(), llvm::APFloat(0.0)),
+      "nottmp");
+    return CI.Builder.CreateUIToFP(
+      IsZero,
+      llvm::Type::getDoubleTy(CI.getContext()),
+      "booltmp");
+  }
   if (F == 0)
     return ErrorV("Unknown unary operator");
 
-  return Builder.CreateCall(F, OperandV, "unop");
+  return EmitCall(CI, F, OperandV, "unop");
+}
+
+/// EmitShortCircuit - Emit 'LHS && RHS', or 'LHS || RHS' if IsAnd is false,
+/// as a branch around the RHS.  The result is 1.0 or 0.0.
+static llvm::Value *EmitShortCircuit(CompilerInstance &CI, bool IsAnd,
+                                     ExprAST *LHS, ExprAST *RHS) {
+  llvm::Value *Zero =
+    llvm::ConstantFP::get(CI.getContext(), llvm::APFloat(0.0));
+
+  llvm::Value *L = LHS->Codegen(CI);
+  if (L == 0) return 0;
+  L = CI.Builder.CreateFCmpONE(L, Zero, "lhscond");
+
+  llvm::Function *TheFunction = CI.Builder.GetInsertBlock()->getParent();
+  llvm::BasicBlock *LHSBB = CI.Builder.GetInsertBlock();
+  llvm::BasicBlock *RHSBB = llvm::BasicBlock::Create(
+    CI.getContext(),
+    IsAnd ? "andrhs" : "orrhs",
+    TheFunction);
+  llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(
+    CI.getContext(),
+    IsAnd ? "andcont" : "orcont");
+
+  // A false LHS decides '&&', a true one decides '||'.
+  if (IsAnd)
+    CI.Builder.CreateCondBr(L, RHSBB, MergeBB);
+  else
+    CI.Builder.CreateCondBr(L, MergeBB, RHSBB);
+
+  CI.Builder.SetInsertPoint(RHSBB);
+  llvm::Value *R = RHS->Codegen(CI);
+  if (R == 0) return 0;
+  R = CI.Builder.CreateFCmpONE(R, Zero, "rhscond");
+  // Codegen of the RHS can change the current block, update RHSBB for the
+  // PHI.
+  RHSBB = CI.Builder.GetInsertBlock();
+  CI.Builder.CreateBr(MergeBB);
+
+  TheFunction->getBasicBlockList().push_back(MergeBB);
+  CI.Builder.SetInsertPoint(MergeBB);
+  llvm::PHINode *PN = CI.Builder.CreatePHI(
+    llvm::Type::getInt1Ty(CI.getContext()),
+    2,
+    "logictmp");
+  PN->addIncoming(llvm::ConstantInt::get(
+                    llvm::Type::getInt1Ty(CI.getContext()), !IsAnd),
+                  LHSBB);
+  PN->addIncoming(R, RHSBB);
+  return CI.Builder.CreateUIToFP(
+    PN,
+    llvm::Type::getDoubleTy(CI.getContext()),
+    "booltmp");
 }
 
-llvm::Value *BinaryExprAST::Codegen() {
+llvm::Value *BinaryExprAST::Codegen(CompilerInstance &CI) {
   // Special case '=' because we don't want to emit the LHS as an expression.
   if (Op == '=') {
     // Assignment requires the LHS to be an identifier.
@@ -78,47 +198,94 @@ llvm::Value *BinaryExprAST::Codegen() {
     if (!LHSE)
       return ErrorV("destination of '=' must be a variable");
     // Codegen the RHS.
-    llvm::Value *Val = RHS->Codegen();
+    llvm::Value *Val = RHS->Codegen(CI);
     if (Val == 0) return 0;
 
     // Look up the name.
-    llvm::Value *Variable = NamedValues[LHSE->getName()];
+    llvm::Value *Variable = CI.NamedValues[LHSE->getName()];
     if (Variable == 0) return ErrorV("Unknown variable name");
 
-    Builder.CreateStore(Val, Variable);
+    CI.Builder.CreateStore(Val, Variable);
     return Val;
   }
 
-  llvm::Value *L = LHS->Codegen();
-  llvm::Value *R = RHS->Codegen();
+  // '&&' and '||' only evaluate the RHS if the LHS does not decide.
+  if (Op == (char)tok::tok_andand || Op == (char)tok::tok_oror)
+    return EmitShortCircuit(CI, Op == (char)tok::tok_andand, LHS, RHS);
+
+  llvm::Value *L = LHS->Codegen(CI);
+  llvm::Value *R = RHS->Codegen(CI);
   if (L == 0 || R == 0) return 0;
 
   switch (Op) {
-  case '+': return Builder.CreateFAdd(L, R, "addtmp");
-  case '-': return Builder.CreateFSub(L, R, "subtmp");
-  case '*': return Builder.CreateFMul(L, R, "multmp");
+  case '+': return CI.Builder.CreateFAdd(L, R, "addtmp");
+  case '-': return CI.Builder.CreateFSub(L, R, "subtmp");
+  case '*': return CI.Builder.CreateFMul(L, R, "multmp");
   case '<':
-            L = Builder.CreateFCmpULT(L, R, "cmptmp");
+            L = CI.Builder.CreateFCmpULT(L, R, "cmptmp");
             // Convert bool 0/1 to double 0.0 or 1.0
-            return Builder.CreateUIToFP(
+            return CI.Builder.CreateUIToFP(
               L,
-              llvm::Type::getDoubleTy(llvm::getGlobalContext()),
+              llvm::Type::getDoubleTy(CI.getContext()),
               "booltmp");
   default: break;
   }
 
   // If it wasn't a builtin binary operator, it must be a user defined one. Emit
   // a call to it.
-  llvm::Function *F = TheModule->getFunction(std::string("binary")+Op);
+  llvm::Function *F = getFunction(CI, std::string("binary")+Op);
   assert(F && "binary operator not found!");
 
   llvm::Value *Ops[2] = { L, R };
-  return Builder.CreateCall(F, Ops, "binop");
+  return EmitCall(CI, F, Ops, "binop");
 }
 
-llvm::Value *CallExprAST::Codegen() {
+bool BinaryExprAST::assignsTo(const std::string &Name) const {
+  if (Op == '=')
+    if (VariableExprAST *LHSE = llvm::dyn_cast<VariableExprAST>(LHS))
+      if (LHSE->getName() == Name)
+        return true;
+  return LHS->assignsTo(Name) || RHS->assignsTo(Name);
+}
+
+bool CallExprAST::assignsTo(const std::string &Name) const {
+  for (unsigned i = 0, e = Args.size(); i != e; ++i)
+    if (Args[i]->assignsTo(Name))
+      return true;
+  return false;
+}
+
+bool CallExprAST::markTailCalls(const std::string &Name) {
+  TailRecursive = Callee == Name;
+  return TailRecursive;
+}
+
+llvm::Value *CallExprAST::Codegen(CompilerInstance &CI) {
+  // A call of the function itself in tail position is a loop: rebind the
+  // arguments and start the body over, in constant stack space whatever the
+  // tier or the optimizer pipeline.
+  if (TailRecursive && CI.TailHeader && Args.size() == CI.TailArgs.size()) {
+    std::vector<llvm::Value*> ArgsV;
+    for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+      ArgsV.push_back(Args[i]->Codegen(CI));
+      if (ArgsV.back() == 0) return 0;
+    }
+    for (unsigned i = 0, e = ArgsV.size(); i != e; ++i)
+      CI.Builder.CreateStore(ArgsV[i], CI.TailArgs[i]);
+    CI.Builder.CreateBr(CI.TailHeader);
+
+    // The enclosing expressions still expect a value and a block to go on
+    // in; neither is ever reached.
+    llvm::Function *TheFunction = CI.Builder.GetInsertBlock()->getParent();
+    CI.Builder.SetInsertPoint(llvm::BasicBlock::Create(
+      CI.getContext(),
+      "aftertail",
+      TheFunction));
+    return llvm::UndefValue::get(llvm::Type::getDoubleTy(CI.getContext()));
+  }
+
   // Look up the name in the global module table.
-  llvm::Function *CalleeF = TheModule->getFunction(Callee);
+  llvm::Function *CalleeF = getFunction(CI, Callee);
   if (CalleeF == 0)
     return ErrorV("Unknown function referenced");
 
@@ -128,66 +295,66 @@ llvm::Value *CallExprAST::Codegen() {
 
   std::vector<llvm::Value*> ArgsV;
   for (unsigned i = 0, e = Args.size(); i != e; ++i) {
-    ArgsV.push_back(Args[i]->Codegen());
+    ArgsV.push_back(Args[i]->Codegen(CI));
     if (ArgsV.back() == 0) return 0;
   }
 
-  return Builder.CreateCall(CalleeF, ArgsV, "calltmp");
+  return EmitCall(CI, CalleeF, ArgsV, "calltmp");
 }
 
-llvm::Value *IfExprAST::Codegen() {
-  llvm::Value *CondV = Cond->Codegen();
+llvm::Value *IfExprAST::Codegen(CompilerInstance &CI) {
+  llvm::Value *CondV = Cond->Codegen(CI);
   if (CondV == 0) return 0;
 
   // Convert condition to a bool by comparing equal to 0.0.
-  CondV = Builder.CreateFCmpONE(
+  CondV = CI.Builder.CreateFCmpONE(
     CondV,
-    llvm::ConstantFP::get(llvm::getGlobalContext(), llvm::APFloat(0.0)),
+    llvm::ConstantFP::get(CI.getContext(), llvm::APFloat(0.0)),
     "ifcond");
 
-  llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
+  llvm::Function *TheFunction = CI.Builder.GetInsertBlock()->getParent();
 
   // Create blocks for the then and else cases.  Insert the 'then' block at the
   // end of the function.
   llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(
-    llvm::getGlobalContext(),
+    CI.getContext(),
     "then",
     TheFunction);
   llvm::BasicBlock *ElseBB = llvm::BasicBlock::Create(
-    llvm::getGlobalContext(),
+    CI.getContext(),
     "else");
   llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(
-    llvm::getGlobalContext(),
+    CI.getContext(),
     "ifcont");
 
-  Builder.CreateCondBr(CondV, ThenBB, ElseBB);
+  CI.Builder.CreateCondBr(CondV, ThenBB, ElseBB);
 
   // Emit then value.
-  Builder.SetInsertPoint(ThenBB);
+  CI.Builder.SetInsertPoint(ThenBB);
 
-  llvm::Value *ThenV = Then->Codegen();
+  llvm::Value *ThenV = Then->Codegen(CI);
   if (ThenV == 0) return 0;
 
-  Builder.CreateBr(MergeBB);
+  CI.Builder.CreateBr(MergeBB);
   // Codegen of 'Then' can change the current block, update ThenBB for the PHI.
-  ThenBB = Builder.GetInsertBlock();
+  ThenBB = CI.Builder.GetInsertBlock();
 
   // Emit else block.
   TheFunction->getBasicBlockList().push_back(ElseBB);
-  Builder.SetInsertPoint(ElseBB);
+  CI.Builder.SetInsertPoint(ElseBB);
 
-  llvm::Value *ElseV = Else->Codegen();
+  llvm::Value *ElseV = Else->Codegen(CI);
   if (ElseV == 0) return 0;
 
-  Builder.CreateBr(MergeBB);
+  CI.Builder.CreateBr(MergeBB);
   // Codegen of 'Else' can change the current block, update ElseBB for the PHI.
-  ElseBB = Builder.GetInsertBlock();
+  ElseBB = CI.Builder.GetInsertBlock();
 
   // Emit merge block.
   TheFunction->getBasicBlockList().push_back(MergeBB);
-  Builder.SetInsertPoint(MergeBB);
-  llvm::PHINode *PN = Builder.CreatePHI(
-    llvm::Type::getDoubleTy(llvm::getGlobalContext()),
+  CI.Builder.SetInsertPoint(MergeBB);
+  llvm::PHINode *PN = CI.Builder.CreatePHI(
+    llvm::Type::getDoubleTy(CI.getContext()),
     2,
     "iftmp");
 
@@ -196,7 +363,44 @@ llvm::Value *IfExprAST::Codegen() {
   return PN;
 }
 
-llvm::Value *ForExprAST::Codegen() {
+bool IfExprAST::markTailCalls(const std::string &Name) {
+  // Both branches are, so mark both.
+  bool ThenTail = Then->markTailCalls(Name);
+  bool ElseTail = Else->markTailCalls(Name);
+  return ThenTail || ElseTail;
+}
+
+bool ForExprAST::assignsTo(const std::string &Name) const {
+  return Start->assignsTo(Name) || End->assignsTo(Name) ||
+         (Step && Step->assignsTo(Name)) || Body->assignsTo(Name);
+}
+
+bool ForExprAST::isBounded() const {
+  // 'for i = c1, i < c2, c3': the end condition is taken before the step.
+  NumberExprAST *StartN = llvm::dyn_cast<NumberExprAST>(Start);
+  NumberExprAST *StepN = Step ? llvm::dyn_cast<NumberExprAST>(Step) : 0;
+  BinaryExprAST *Cmp = llvm::dyn_cast<BinaryExprAST>(End);
+  if (!StartN || (Step && !StepN) || !Cmp || Cmp->getOpcode() != '<')
+    return false;
+  VariableExprAST *Var = llvm::dyn_cast<VariableExprAST>(Cmp->getLHS());
+  NumberExprAST *Bound = llvm::dyn_cast<NumberExprAST>(Cmp->getRHS());
+  if (!Var || Var->getName() != VarName || !Bound)
+    return false;
+  if (Body->assignsTo(VarName))
+    return false;
+
+  // The step must move the variable on all the way to the bound.  Adding a
+  // small step to a large double changes nothing, and the spacing of doubles
+  // only grows with their magnitude, so look at the largest one reached.
+  double StepV = StepN ? StepN->getValue() : 1.0;
+  double Max = std::max(std::fabs(StartN->getValue()),
+                        std::fabs(Bound->getValue())) + StepV;
+  if (!(StepV > 0) || !(Max < HUGE_VAL))
+    return false;
+  return Max + StepV > Max && -Max + StepV > -Max;
+}
+
+llvm::Value *ForExprAST::Codegen(CompilerInstance &CI) {
   // Output this as:
   //   var = alloca double
   //   ...
@@ -217,98 +421,112 @@ llvm::Value *ForExprAST::Codegen() {
   //   br endcond, loop, endloop
   // outloop:
 
-  llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
+  llvm::Function *TheFunction = CI.Builder.GetInsertBlock()->getParent();
 
   // Create an alloca for the variable in the entry block.
   llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
 
   // Emit the start code first, without 'variable' in scope.
-  llvm::Value *StartVal = Start->Codegen();
+  llvm::Value *StartVal = Start->Codegen(CI);
   if (StartVal == 0) return 0;
 
   // Store the value into the alloca.
-  Builder.CreateStore(StartVal, Alloca);
+  CI.Builder.CreateStore(StartVal, Alloca);
 
   // Make the new basic block for the loop header, inserting after current
   // block.
   llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(
-    llvm::getGlobalContext(),
+    CI.getContext(),
     "loop",
     TheFunction);
 
   // Insert an explicit fall through from the current block to the LoopBB.
-  Builder.CreateBr(LoopBB);
+  CI.Builder.CreateBr(LoopBB);
+
+  // Under tiered execution the loop header is an on-stack replacement point.
+  if (CI.TheOptimizer)
+    CI.TheOptimizer->addLoopHeader(LoopBB);
+
+  if (!isBounded())
+    CI.UnboundedLoop = true;
 
   // Start insertion in LoopBB.
-  Builder.SetInsertPoint(LoopBB);
+  CI.Builder.SetInsertPoint(LoopBB);
 
   // Within the loop, the variable is defined equal to the PHI node.  If it
   // shadows an existing variable, we have to restore it, so save it now.
-  llvm::AllocaInst *OldVal = NamedValues[VarName];
-  NamedValues[VarName] = Alloca;
+  llvm::AllocaInst *OldVal = CI.NamedValues[VarName];
+  CI.NamedValues[VarName] = Alloca;
 
   // Emit the body of the loop.  This, like any other expr, can change the
   // current BB.  Note that we ignore the value computed by the body, but don't
   // allow an error.
-  if (Body->Codegen() == 0)
+  if (Body->Codegen(CI) == 0)
     return 0;
 
   // Emit the step value.
   llvm::Value *StepVal;
   if (Step) {
-    StepVal = Step->Codegen();
+    StepVal = Step->Codegen(CI);
     if (StepVal == 0) return 0;
   } else {
     // If not specified, use 1.0.
     StepVal = llvm::ConstantFP::get(
-      llvm::getGlobalContext(),
+      CI.getContext(),
       llvm::APFloat(1.0));
   }
 
   // Compute the end condition.
-  llvm::Value *EndCond = End->Codegen();
+  llvm::Value *EndCond = End->Codegen(CI);
   if (EndCond == 0) return EndCond;
 
   // Reload, increment, and restore the alloca.  This handles the case where
   // the body of the loop mutates the variable.
-  llvm::Value *CurVar = Builder.CreateLoad(Alloca, VarName.c_str());
-  llvm::Value *NextVar = Builder.CreateFAdd(CurVar, StepVal, "nextvar");
-  Builder.CreateStore(NextVar, Alloca);
+  llvm::Value *CurVar = CI.Builder.CreateLoad(Alloca, VarName.c_str());
+  llvm::Value *NextVar = CI.Builder.CreateFAdd(CurVar, StepVal, "nextvar");
+  CI.Builder.CreateStore(NextVar, Alloca);
 
   // Convert condition to a bool by comparing equal to 0.0.
-  EndCond = Builder.CreateFCmpONE(
+  EndCond = CI.Builder.CreateFCmpONE(
     EndCond,
-    llvm::ConstantFP::get(llvm::getGlobalContext(), llvm::APFloat(0.0)),
+    llvm::ConstantFP::get(CI.getContext(), llvm::APFloat(0.0)),
     "loopcond");
 
   // Create the "after loop" block and insert it.
   llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(
-    llvm::getGlobalContext(),
+    CI.getContext(),
     "afterloop",
     TheFunction);
 
   // Insert the conditional branch into the end of LoopEndBB.
-  Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
+  CI.Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
 
   // Any new code will be inserted in AfterBB.
-  Builder.SetInsertPoint(AfterBB);
+  CI.Builder.SetInsertPoint(AfterBB);
 
   // Restore the unshadowed variable.
   if (OldVal)
-    NamedValues[VarName] = OldVal;
+    CI.NamedValues[VarName] = OldVal;
   else
-    NamedValues.erase(VarName);
+    CI.NamedValues.erase(VarName);
 
   // for expr always returns 0.0.
   return llvm::Constant::getNullValue(
-    llvm::Type::getDoubleTy(llvm::getGlobalContext()));
+    llvm::Type::getDoubleTy(CI.getContext()));
 }
 
 
-llvm::Value *VarExprAST::Codegen() {
+bool VarExprAST::assignsTo(const std::string &Name) const {
+  for (unsigned i = 0, e = VarNames.size(); i != e; ++i)
+    if (VarNames[i].second && VarNames[i].second->assignsTo(Name))
+      return true;
+  return Body->assignsTo(Name);
+}
+
+llvm::Value *VarExprAST::Codegen(CompilerInstance &CI) {
   std::vector<llvm::AllocaInst *> OldBindings;
 
-  llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
+  llvm::Function *TheFunction = CI.Builder.GetInsertBlock()->getParent();
 
   // Register all variables and emit their initializer.
   for (unsigned i = 0, e = VarNames.size(); i != e; ++i) {
@@ -322,44 +540,44 @@ llvm::Value *VarExprAST::Codegen() {
     //    var a = a in ...   # refers to outer 'a'.
     llvm::Value *InitVal;
     if (Init) {
-      InitVal = Init->Codegen();
+      InitVal = Init->Codegen(CI);
       if (InitVal == 0) return 0;
     } else { // If not specified, use 0.0.
-      InitVal = llvm::ConstantFP::get(llvm::getGlobalContext(),
+      InitVal = llvm::ConstantFP::get(CI.getContext(),
                                       llvm::APFloat(0.0));
     }
 
     llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
-    Builder.CreateStore(InitVal, Alloca);
+    CI.Builder.CreateStore(InitVal, Alloca);
 
     // Remember the old variable binding so that we can restore the binding when
     // we unrecurse.
-    OldBindings.push_back(NamedValues[VarName]);
+    OldBindings.push_back(CI.NamedValues[VarName]);
 
     // Remember this binding.
-    NamedValues[VarName] = Alloca;
+    CI.NamedValues[VarName] = Alloca;
   }
 
   // Codegen the body, now that all vars are in scope.
-  llvm::Value *BodyVal = Body->Codegen();
+  llvm::Value *BodyVal = Body->Codegen(CI);
   if (BodyVal == 0) return 0;
 
   // Pop all our variables from scope.
   for (unsigned i = 0, e = VarNames.size(); i != e; ++i)
-    NamedValues[VarNames[i].first] = OldBindings[i];
+    CI.NamedValues[VarNames[i].first] = OldBindings[i];
 
   // Return the body computation.
   return BodyVal;
 }
 
 
-llvm::Function *PrototypeAST::Codegen() {
+llvm::Function *PrototypeAST::Codegen(CompilerInstance &CI) {
   // Make the function type:  double(double,double) etc.
   std::vector<llvm::Type*> Doubles(
     Args.size(),
-    llvm::Type::getDoubleTy(llvm::getGlobalContext()));
+    llvm::Type::getDoubleTy(CI.getContext()));
   llvm::FunctionType *FT = llvm::FunctionType::get(
-    llvm::Type::getDoubleTy(llvm::getGlobalContext()),
+    llvm::Type::getDoubleTy(CI.getContext()),
     Doubles,
     false);
 
@@ -367,14 +585,14 @@ llvm::Function *PrototypeAST::Codegen() {
     FT,
     llvm::Function::ExternalLinkage,
     Name,
-    TheModule);
+    CI.TheModule);
 
   // If F conflicted, there was already something named 'Name'.  If it has a
   // body, don't allow redefinition or reextern.
   if (F->getName() != Name) {
     // Delete the one we just made and get the existing one.
     F->eraseFromParent();
-    F = TheModule->getFunction(Name);
+    F = CI.TheModule->getFunction(Name);
 
     // If F already has a body, reject this.
     if (!F->empty()) {
@@ -395,69 +613,312 @@ llvm::Function *PrototypeAST::Codegen() {
        ++AI, ++Idx)
     AI->setName(Args[Idx]);
 
+  // Nothing unwinds through klang code or the C functions it calls.  What
+  // a function of an earlier item does is known, so the optimizer may
+  // fold, hoist and delete calls to it.
+  F->setDoesNotThrow();
+  if (IsReadNone(CI, F))
+    F->setDoesNotAccessMemory();
+
   return F;
 }
 
 
+/// CheckRedefinition - Every top-level item is generated into a module of its
+/// own, so a conflict with an earlier item is not visible in TheModule.  Check
+/// the prototype table and the JIT instead.  In whole-program mode, the
+/// program module has the bodies.
+bool PrototypeAST::CheckRedefinition(CompilerInstance &CI) const {
+  if (Name.empty())
+    return true;
+
+  // If there is already a body, don't allow redefinition or reextern, unless
+  // its callers go through a stub the new body can take over.
+  bool Defined;
+  if (CI.WholeProgram) {
+    llvm::Function *F = CI.TheModule ? CI.TheModule->getFunction(Name) : 0;
+    Defined = F && !F->isDeclaration();
+  } else {
+    Defined = CI.TheJIT->findSymbol(Name) && !CI.TheJIT->isRedefinable(Name);
+  }
+  if (Defined) {
+    ErrorF("redefinition of function");
+    return false;
+  }
+
+  PrototypeAST *Prev = CI.getPrototype(Name);
+  if (Prev && Prev->Args.size() != Args.size()) {
+    ErrorF("redefinition of function with different # args");
+    return false;
+  }
+
+  return true;
+}
+
+
 /// CreateArgumentAllocas - Create an alloca for each argument and register the
 /// argument in the symbol table so that references to it will succeed.
-void PrototypeAST::CreateArgumentAllocas(llvm::Function *F) {
+void PrototypeAST::CreateArgumentAllocas(CompilerInstance &CI,
+                                         llvm::Function *F) {
+  CI.TailArgs.clear();
   llvm::Function::arg_iterator AI = F->arg_begin();
   for (unsigned Idx = 0, e = Args.size(); Idx != e; ++Idx, ++AI) {
     // Create an alloca for this variable.
     llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(F, Args[Idx]);
 
     // Store the initial value into the alloca.
-    Builder.CreateStore(AI, Alloca);
+    CI.Builder.CreateStore(AI, Alloca);
+
+    // Add arguments to variable symbol table.  A 'var' may shadow one, so
+    // tail calls keep the allocas apart.
+    CI.NamedValues[Args[Idx]] = Alloca;
+    CI.TailArgs.push_back(Alloca);
+  }
+}
+
+
+/// OptimizeFunction - Run TheFPM over F, unless the cache has the result.
+/// With a thread pool, F is only optimized when the pool is joined.
+static void OptimizeFunction(CompilerInstance &CI, llvm::Function *F) {
+  std::string Key;
+  if (CI.TheCache) {
+    Key = CI.TheCache->getKey(F);
+    if (CI.TheCache->load(Key, F))
+      return;
+  }
+
+  if (CI.TheParallelOptimizer) {
+    CI.TheParallelOptimizer->enqueue(F, Key);
+    return;
+  }
+
+  CI.TheFPM->run(*F);
+
+  if (CI.TheCache)
+    CI.TheCache->store(Key, F);
+}
 
-    // Add arguments to variable symbol table.
-    NamedValues[Args[Idx]] = Alloca;
+/// IsPure - Whether the freshly generated F has no side effects.  Memory is
+/// only touched through its own allocas, and the only calls are direct ones
+/// to F itself and to functions already known to be pure.  Externs are not,
+/// and neither is a call through a stub, which a redefinition may take over.
+static bool IsPure(CompilerInstance &CI, llvm::Function *F) {
+  for (llvm::Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+    for (llvm::BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E;
+         ++I) {
+      if (llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(I)) {
+        if (!llvm::isa<llvm::AllocaInst>(LI->getPointerOperand()))
+          return false;
+      } else if (llvm::StoreInst *SI = llvm::dyn_cast<llvm::StoreInst>(I)) {
+        if (!llvm::isa<llvm::AllocaInst>(SI->getPointerOperand()))
+          return false;
+      } else if (llvm::CallInst *Call = llvm::dyn_cast<llvm::CallInst>(I)) {
+        llvm::Function *Callee = Call->getCalledFunction();
+        if (!Callee)
+          return false;
+        if (Callee != F && !Callee->isIntrinsic() &&
+            !CI.PureFunctions.count(Callee->getName()))
+          return false;
+      }
+    }
+  return true;
+}
+
+/// IsTerminating - Whether the pure function F is known to return, given
+/// that its loops are bounded and it is not tail recursive: it does not call
+/// itself, and only calls functions known to return.  Purity alone does not
+/// make a call safe to delete; a function that spins forever has no side
+/// effects either.
+static bool IsTerminating(CompilerInstance &CI, llvm::Function *F) {
+  for (llvm::Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+    for (llvm::BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E;
+         ++I)
+      if (llvm::CallInst *Call = llvm::dyn_cast<llvm::CallInst>(I)) {
+        llvm::Function *Callee = Call->getCalledFunction();
+        if (!Callee || Callee == F)
+          return false;
+        if (!Callee->isIntrinsic() &&
+            !CI.TerminatingFunctions.count(Callee->getName()))
+          return false;
+      }
+  return true;
+}
+
+/// MemoizeFunction - Move the body of the pure function F into F.impl, and
+/// make F look its arguments up in a table of earlier results before
+/// calling it.  Recursive calls still go to F, so they hit the table too.
+/// Returns F.impl.
+///
+/// F.impl and the table F.memo are external, so that an importing module
+/// can link to them once the body of F is inlined there.
+static llvm::Function *MemoizeFunction(llvm::Function *F) {
+  llvm::Module *M = F->getParent();
+  llvm::LLVMContext &Context = F->getContext();
+  llvm::Type *DoubleTy = llvm::Type::getDoubleTy(Context);
+  llvm::Type *Int32Ty = llvm::Type::getInt32Ty(Context);
+  llvm::PointerType *Int8PtrTy = llvm::Type::getInt8PtrTy(Context);
+  llvm::PointerType *DoublePtrTy = llvm::Type::getDoublePtrTy(Context);
+
+  llvm::Function *Impl = llvm::Function::Create(
+    F->getFunctionType(), llvm::Function::ExternalLinkage,
+    F->getName() + ".impl", M);
+  Impl->setAttributes(F->getAttributes());
+  Impl->getBasicBlockList().splice(Impl->begin(), F->getBasicBlockList());
+  for (llvm::Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end(),
+       II = Impl->arg_begin(); AI != AE; ++AI, ++II) {
+    II->setName(AI->getName());
+    AI->replaceAllUsesWith(II);
   }
+
+  llvm::GlobalVariable *Table = new llvm::GlobalVariable(
+    *M, Int8PtrTy, false, llvm::GlobalValue::ExternalLinkage,
+    llvm::ConstantPointerNull::get(Int8PtrTy), F->getName() + ".memo");
+  llvm::Constant *Lookup = M->getOrInsertFunction(
+    "klang_memo_lookup", Int32Ty, Table->getType(), DoublePtrTy, Int32Ty,
+    DoublePtrTy, (llvm::Type*)0);
+  llvm::Constant *Store = M->getOrInsertFunction(
+    "klang_memo_store", llvm::Type::getVoidTy(Context), Table->getType(),
+    DoublePtrTy, Int32Ty, DoubleTy, (llvm::Type*)0);
+
+  llvm::BasicBlock *Entry = llvm::BasicBlock::Create(Context, "entry", F);
+  llvm::BasicBlock *HitBB = llvm::BasicBlock::Create(Context, "memohit", F);
+  llvm::BasicBlock *MissBB = llvm::BasicBlock::Create(Context, "memomiss", F);
+  llvm::IRBuilder<> B(Entry);
+
+  // The arguments go into an array, the key of the table.
+  llvm::Value *NumArgs = B.getInt32(F->arg_size());
+  llvm::Value *Args = B.CreateAlloca(DoubleTy, NumArgs, "args");
+  llvm::Value *Result = B.CreateAlloca(DoubleTy, 0, "result");
+  std::vector<llvm::Value*> ArgsV;
+  unsigned Idx = 0;
+  for (llvm::Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+       AI != AE; ++AI, ++Idx) {
+    B.CreateStore(AI, B.CreateConstGEP1_32(Args, Idx));
+    ArgsV.push_back(AI);
+  }
+  llvm::Value *Found = B.CreateCall4(Lookup, Table, Args, NumArgs, Result,
+                                     "found");
+  B.CreateCondBr(B.CreateICmpNE(Found, B.getInt32(0)), HitBB, MissBB);
+
+  B.SetInsertPoint(HitBB);
+  B.CreateRet(B.CreateLoad(Result, "memoized"));
+
+  B.SetInsertPoint(MissBB);
+  llvm::Value *V = B.CreateCall(Impl, ArgsV, "value");
+  B.CreateCall4(Store, Table, Args, NumArgs, V);
+  B.CreateRet(V);
+
+  llvm::verifyFunction(*F);
+  return Impl;
 }
 
+llvm::Function *FunctionAST::Codegen(CompilerInstance &CI) {
+  CI.NamedValues.clear();
 
-llvm::Function *FunctionAST::Codegen() {
-  NamedValues.clear();
+  if (!Proto->CheckRedefinition(CI))
+    return 0;
 
-  llvm::Function *TheFunction = Proto->Codegen();
+  llvm::Function *TheFunction = Proto->Codegen(CI);
   if (TheFunction == 0)
     return 0;
 
   // If this is an operator, install it.
   if (Proto->isBinaryOp())
-    Token::BinopPrecedence[Proto->getOperatorName()] =
+    CI.BinopPrecedence[Proto->getOperatorName()] =
       Proto->getBinaryPrecedence();
 
+  // Under tiered execution named functions are called through a slot.  Create
+  // it before the body so that recursive calls go through it too.
+  if (CI.TheOptimizer && !Proto->getName().empty())
+    CI.TheOptimizer->createSlot(TheFunction);
+
   // Create a new basic block to start insertion into.
   llvm::BasicBlock *BB = llvm::BasicBlock::Create(
-    llvm::getGlobalContext(),
+    CI.getContext(),
     "entry",
     TheFunction);
-  Builder.SetInsertPoint(BB);
+  CI.Builder.SetInsertPoint(BB);
 
   // Add all arguments to the symbol table and create their allocas.
-  Proto->CreateArgumentAllocas(TheFunction);
+  Proto->CreateArgumentAllocas(CI, TheFunction);
+
+  // Self-recursive tail calls jump to a block after the allocas.
+  CI.TailHeader = 0;
+  CI.UnboundedLoop = false;
+  if (!Proto->getName().empty() && Body->markTailCalls(Proto->getName())) {
+    CI.TailHeader = llvm::BasicBlock::Create(
+      CI.getContext(),
+      "tailrecurse",
+      TheFunction);
+    CI.Builder.CreateBr(CI.TailHeader);
+    CI.Builder.SetInsertPoint(CI.TailHeader);
+  }
 
-  if (llvm::Value *RetVal = Body->Codegen()) {
+  llvm::Value *RetVal = Body->Codegen(CI);
+  bool Loops = CI.TailHeader || CI.UnboundedLoop;
+  CI.TailHeader = 0;
+  if (RetVal) {
     // Finish off the function.
-    Builder.CreateRet(RetVal);
+    CI.Builder.CreateRet(RetVal);
 
     // Validate the generated code, checking for consistency.
     llvm::verifyFunction(*TheFunction);
 
+    // Record whether the function is pure, and whether it is known to
+    // return, for its callers to come.
+    bool Pure = IsPure(CI, TheFunction);
+    bool Terminates = Pure && !Loops && IsTerminating(CI, TheFunction);
+    if (!Proto->getName().empty()) {
+      if (Pure)
+        CI.PureFunctions.insert(Proto->getName());
+      else
+        CI.PureFunctions.erase(Proto->getName());
+      if (Terminates)
+        CI.TerminatingFunctions.insert(Proto->getName());
+      else
+        CI.TerminatingFunctions.erase(Proto->getName());
+    }
+    if (Terminates && IsReadNone(CI, TheFunction))
+      TheFunction->setDoesNotAccessMemory();
+    else
+      TheFunction->removeFnAttr(llvm::Attribute::ReadNone);
+
+    // A pure function is only worth remembering if it takes arguments.  The
+    // tiers keep the body in place, so they go without.
+    llvm::Function *Impl = 0;
+    if (CI.Memoize && Pure && !CI.TheOptimizer &&
+        !Proto->getName().empty() && !TheFunction->arg_empty())
+      Impl = MemoizeFunction(TheFunction);
+
     //----------------------
-    // Optimize the function.
+    // Optimize the function, unless the background optimizer will.
     //----------------------
-    TheFPM->run(*TheFunction);
+    if (!CI.TheOptimizer) {
+      if (Impl)
+        OptimizeFunction(CI, Impl);
+      OptimizeFunction(CI, TheFunction);
+    }
+
+    // Later items call this function through its prototype.
+    if (!Proto->getName().empty())
+      CI.FunctionProtos[Proto->getName()] = Proto;
 
     return TheFunction;
   }
 
   // Error reading body, remove function.
+  if (CI.TheOptimizer)
+    CI.TheOptimizer->forgetFunction(TheFunction);
   TheFunction->eraseFromParent();
 
-  if (Proto->isBinaryOp())
-    Token::BinopPrecedence.erase(Proto->getOperatorName());
+  // A failed redefinition leaves the operator as it was.
+  if (Proto->isBinaryOp()) {
+    if (PrototypeAST *Prev = CI.getPrototype(Proto->getName()))
+      CI.BinopPrecedence[Proto->getOperatorName()] =
+        Prev->getBinaryPrecedence();
+    else
+      CI.BinopPrecedence.erase(Proto->getOperatorName());
+  }
   return 0;
 }
 
@@ -0,0 +1,79 @@
+//===--- Memo.cpp - ---------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the memo tables of memoized functions.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/Builtin/Memo.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+  /// MemoEntries - The number of entries in a table.  A power of two.
+  const unsigned MemoEntries = 4096;
+
+  /// MemoTable - The results of one function.  It is direct-mapped: the
+  /// arguments hash to one entry, and a newer result there evicts the older
+  /// one, so a table never grows past MemoEntries results.
+  ///
+  /// Arguments are compared bit for bit, which tells -0.0 from 0.0 and
+  /// finds a NaN again.
+  struct MemoTable {
+    unsigned char Valid[MemoEntries];
+    /// Slots - NumArgs arguments then the result, for each entry.
+    double Slots[1];
+  };
+}
+
+/// getTable - Return the table at *Table, allocating it on first use.
+static MemoTable *getTable(void **Table, unsigned NumArgs) {
+  if (!*Table)
+    *Table = calloc(1, sizeof(MemoTable) +
+                       MemoEntries * (NumArgs + 1) * sizeof(double));
+  return static_cast<MemoTable*>(*Table);
+}
+
+/// getSlot - Return the entry the arguments at Args map to.
+static unsigned getSlot(const double *Args, unsigned NumArgs) {
+  // FNV-1a over the bits of the arguments.
+  const unsigned char *P = reinterpret_cast<const unsigned char*>(Args);
+  unsigned Hash = 2166136261u;
+  for (unsigned i = 0, e = NumArgs * sizeof(double); i != e; ++i)
+    Hash = (Hash ^ P[i]) * 16777619u;
+  return Hash & (MemoEntries - 1);
+}
+
+int klang_memo_lookup(void **Table, const double *Args, unsigned NumArgs,
+                      double *Result) {
+  MemoTable *T = getTable(Table, NumArgs);
+  if (!T)
+    return 0;
+
+  unsigned Slot = getSlot(Args, NumArgs);
+  const double *Entry = T->Slots + Slot * (NumArgs + 1);
+  if (!T->Valid[Slot] || memcmp(Entry, Args, NumArgs * sizeof(double)))
+    return 0;
+  *Result = Entry[NumArgs];
+  return 1;
+}
+
+void klang_memo_store(void **Table, const double *Args, unsigned NumArgs,
+                      double Result) {
+  MemoTable *T = getTable(Table, NumArgs);
+  if (!T)
+    return;
+
+  unsigned Slot = getSlot(Args, NumArgs);
+  double *Entry = T->Slots + Slot * (NumArgs + 1);
+  memcpy(Entry, Args, NumArgs * sizeof(double));
+  Entry[NumArgs] = Result;
+  T->Valid[Slot] = 1;
+}
@@ -0,0 +1,122 @@
+//===--- BackendUtil.cpp - --------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the ahead-of-time code generation helpers.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/CodeGen/BackendUtil.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+using namespace klang;
+
+
+llvm::TargetMachine *klang::CreateHostTargetMachine(std::string &ErrStr) {
+  std::string Triple = llvm::sys::getDefaultTargetTriple();
+  const llvm::Target *T = llvm::TargetRegistry::lookupTarget(Triple, ErrStr);
+  if (!T)
+    return 0;
+
+  // The object is linked by the system compiler, which may well produce a
+  // position independent executable.
+  llvm::TargetMachine *TM = T->createTargetMachine(
+    Triple,
+    llvm::sys::getHostCPUName(),
+    "",
+    llvm::TargetOptions(),
+    llvm::Reloc::PIC_);
+  if (!TM)
+    ErrStr = "no target machine for " + Triple;
+  return TM;
+}
+
+llvm::Function *
+klang::EmitMainFunction(llvm::Module *M,
+                        const std::vector<llvm::Function*> &Exprs,
+                        std::string &ErrStr) {
+  llvm::LLVMContext &Context = M->getContext();
+  llvm::FunctionType *MainTy =
+    llvm::FunctionType::get(llvm::Type::getInt32Ty(Context), false);
+
+  // An 'extern main' only declares the function we are about to define.  An
+  // unused declaration of another type can simply go.
+  llvm::Function *Main = M->getFunction("main");
+  if (Main && !Main->isDeclaration()) {
+    ErrStr = "'main' cannot be defined in a compiled program";
+    return 0;
+  }
+  if (Main && Main->getFunctionType() != MainTy) {
+    if (!Main->use_empty()) {
+      ErrStr = "'main' cannot be called in a compiled program";
+      return 0;
+    }
+    Main->eraseFromParent();
+    Main = 0;
+  }
+  if (!Main)
+    Main = llvm::Function::Create(
+      MainTy,
+      llvm::Function::ExternalLinkage,
+      "main",
+      M);
+
+  // The expressions are only reachable from here, so they need no symbol.
+  llvm::IRBuilder<> B(llvm::BasicBlock::Create(Context, "entry", Main));
+  for (unsigned i = 0, e = Exprs.size(); i != e; ++i) {
+    Exprs[i]->setLinkage(llvm::Function::InternalLinkage);
+    B.CreateCall(Exprs[i]);
+  }
+  B.CreateRet(B.getInt32(0));
+  return Main;
+}
+
+bool klang::EmitBackendOutput(llvm::Module *M, llvm::TargetMachine &TM,
+                              BackendAction Action, llvm::raw_ostream &OS,
+                              std::string &ErrStr) {
+  llvm::TargetMachine::CodeGenFileType FileType;
+  switch (Action) {
+  case Backend_EmitNothing:
+    return true;
+  case Backend_EmitLL:
+    M->print(OS, 0);
+    return true;
+  case Backend_EmitBC:
+    llvm::WriteBitcodeToFile(M, OS);
+    return true;
+  case Backend_EmitAssembly:
+    FileType = llvm::TargetMachine::CGFT_AssemblyFile;
+    break;
+  case Backend_EmitObj:
+    FileType = llvm::TargetMachine::CGFT_ObjectFile;
+    break;
+  }
+
+  llvm::PassManager PM;
+  PM.add(new llvm::DataLayout(*TM.getDataLayout()));
+
+  llvm::formatted_raw_ostream FOS(OS);
+  if (TM.addPassesToEmitFile(PM, FOS, FileType)) {
+    ErrStr = "target does not support generation of this file type";
+    return false;
+  }
+
+  PM.run(*M);
+  return true;
+}
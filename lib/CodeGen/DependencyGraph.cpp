@@ -0,0 +1,153 @@
+//===--- DependencyGraph.cpp - ----------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the DependencyGraph class.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/CodeGen/DependencyGraph.h"
+#include "klang/CodeGen/OptimizationCache.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include <set>
+
+using namespace klang;
+
+
+DependencyGraph::DependencyGraph()
+  : Unchanged(0), Changed(0), Invalidated(0), Added(0) {
+}
+
+std::string
+DependencyGraph::addFunction(llvm::Function *F, const OptimizationCache &Cache,
+                             const std::map<char, int> &BinopPrecedence) {
+  std::set<std::string> Callees;
+  for (llvm::Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+    for (llvm::BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E;
+         ++I)
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i)
+        if (llvm::Function *G =
+              llvm::dyn_cast<llvm::Function>(I->getOperand(i)))
+          if (G != F && G->hasName() && !G->isIntrinsic())
+            Callees.insert(G->getName());
+
+  Node N;
+  N.OwnKey = Cache.getKey(F);
+  std::string Data = "deps " + N.OwnKey;
+  for (std::set<std::string>::iterator I = Callees.begin(),
+       E = Callees.end(); I != E; ++I) {
+    N.Callees.push_back(*I);
+
+    // A callee compiled by an earlier item has a key of its own.  Other
+    // callees, such as the builtins, only count by name.
+    Data += " " + *I + "=";
+    llvm::StringMap<Node>::const_iterator DI = Nodes.find(*I);
+    if (DI != Nodes.end())
+      Data += DI->second.Key;
+
+    llvm::StringRef Name(*I);
+    if (Name.size() == 7 && Name.startswith("binary")) {
+      std::map<char, int>::const_iterator PI =
+        BinopPrecedence.find(Name.back());
+      if (PI != BinopPrecedence.end())
+        Data += "@" + llvm::itostr(PI->second);
+    }
+  }
+
+  N.Key = Cache.hashKey(Data);
+
+  if (F->hasName()) {
+    llvm::StringMap<Node>::const_iterator PI = Previous.find(F->getName());
+    if (PI == Previous.end())
+      ++Added;
+    else if (PI->second.Key == N.Key)
+      ++Unchanged;
+    else if (PI->second.OwnKey == N.OwnKey)
+      ++Invalidated;
+    else
+      ++Changed;
+    Nodes[F->getName()] = N;
+  }
+  return N.Key;
+}
+
+
+void DependencyGraph::load(llvm::StringRef Path) {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(Path, Buffer))
+    return;
+
+  // One function per line: name, own key, key, then the callees.
+  llvm::SmallVector<llvm::StringRef, 64> Lines;
+  Buffer->getBuffer().split(Lines, "\n", -1, false);
+  for (unsigned i = 0, e = Lines.size(); i != e; ++i) {
+    llvm::SmallVector<llvm::StringRef, 8> Fields;
+    Lines[i].split(Fields, " ", -1, false);
+    if (Fields.size() < 3) {
+      Previous.clear();
+      return;
+    }
+
+    Node &N = Previous[Fields[0]];
+    N.OwnKey = Fields[1];
+    N.Key = Fields[2];
+    N.Callees.assign(Fields.begin() + 3, Fields.end());
+  }
+}
+
+void DependencyGraph::writeNode(llvm::raw_ostream &OS, llvm::StringRef Name,
+                                const Node &N) {
+  OS << Name << " " << N.OwnKey << " " << N.Key;
+  for (unsigned i = 0, e = N.Callees.size(); i != e; ++i)
+    OS << " " << N.Callees[i];
+  OS << "\n";
+}
+
+void DependencyGraph::save(llvm::StringRef Path) const {
+  // Write to a fresh file and rename it into place, like the cache does.
+  int FD;
+  llvm::SmallString<128> TmpPath;
+  if (llvm::sys::fs::unique_file(Path + "-%%%%%%", FD, TmpPath))
+    return;
+
+  bool Failed;
+  {
+    llvm::raw_fd_ostream OS(FD, true);
+    for (llvm::StringMap<Node>::const_iterator I = Previous.begin(),
+         E = Previous.end(); I != E; ++I)
+      if (!Nodes.count(I->getKey()))
+        writeNode(OS, I->getKey(), I->second);
+    for (llvm::StringMap<Node>::const_iterator I = Nodes.begin(),
+         E = Nodes.end(); I != E; ++I)
+      writeNode(OS, I->getKey(), I->second);
+    OS.close();
+    Failed = OS.has_error();
+    OS.clear_error();
+  }
+
+  if (Failed || llvm::sys::fs::rename(TmpPath.str(), Path)) {
+    bool Existed;
+    llvm::sys::fs::remove(TmpPath.str(), Existed);
+  }
+}
+
+void DependencyGraph::printStats(llvm::raw_ostream &OS) const {
+  OS << "dependency graph: " << Unchanged << " unchanged, " << Changed
+     << " edited, " << Invalidated << " recompiled for a dependency, "
+     << Added << " new\n";
+}
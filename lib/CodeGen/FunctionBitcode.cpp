@@ -0,0 +1,164 @@
+//===--- FunctionBitcode.cpp - ----------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the bitcode form of a single function.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/CodeGen/FunctionBitcode.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace klang;
+
+
+/// CollectGlobals - Collect the globals V refers to, looking through constant
+/// expressions.
+static void CollectGlobals(llvm::Value *V,
+                           llvm::SmallPtrSet<llvm::GlobalValue*, 16> &Globals) {
+  if (llvm::GlobalValue *GV = llvm::dyn_cast<llvm::GlobalValue>(V)) {
+    Globals.insert(GV);
+    return;
+  }
+  if (llvm::ConstantExpr *CE = llvm::dyn_cast<llvm::ConstantExpr>(V))
+    for (unsigned i = 0, e = CE->getNumOperands(); i != e; ++i)
+      CollectGlobals(CE->getOperand(i), Globals);
+}
+
+
+std::string klang::WriteFunctionBitcode(llvm::Function *F) {
+  // Build the module from what F uses only: in whole-program mode the
+  // module of F holds the entire program.
+  llvm::Module *Src = F->getParent();
+  llvm::OwningPtr<llvm::Module> M(
+    new llvm::Module(Src->getModuleIdentifier(), F->getContext()));
+  M->setDataLayout(Src->getDataLayout());
+  M->setTargetTriple(Src->getTargetTriple());
+
+  llvm::Function *Body = llvm::Function::Create(
+    F->getFunctionType(), F->getLinkage(), F->getName(), M.get());
+  Body->copyAttributesFrom(F);
+
+  llvm::ValueToValueMapTy VMap;
+  VMap[F] = Body;
+  llvm::Function::arg_iterator DI = Body->arg_begin();
+  for (llvm::Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+       AI != AE; ++AI, ++DI) {
+    DI->setName(AI->getName());
+    VMap[AI] = DI;
+  }
+
+  llvm::SmallPtrSet<llvm::GlobalValue*, 16> Globals;
+  for (llvm::Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+    for (llvm::BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E;
+         ++I)
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i)
+        CollectGlobals(I->getOperand(i), Globals);
+
+  // Declare everything else F refers to, attributes included.
+  for (llvm::SmallPtrSet<llvm::GlobalValue*, 16>::iterator
+       I = Globals.begin(), E = Globals.end(); I != E; ++I) {
+    if (*I == F)
+      continue;
+    if (llvm::Function *G = llvm::dyn_cast<llvm::Function>(*I)) {
+      llvm::Function *Decl = llvm::Function::Create(
+        G->getFunctionType(), llvm::Function::ExternalLinkage, G->getName(),
+        M.get());
+      Decl->copyAttributesFrom(G);
+      Decl->setLinkage(llvm::Function::ExternalLinkage);
+      VMap[G] = Decl;
+    } else if (llvm::GlobalVariable *GV =
+                 llvm::dyn_cast<llvm::GlobalVariable>(*I)) {
+      VMap[GV] = new llvm::GlobalVariable(
+        *M,
+        GV->getType()->getElementType(),
+        GV->isConstant(),
+        llvm::GlobalValue::ExternalLinkage,
+        0,
+        GV->getName());
+    }
+  }
+
+  llvm::SmallVector<llvm::ReturnInst*, 4> Returns;
+  llvm::CloneFunctionInto(Body, F, VMap, true, Returns);
+
+  std::string Bitcode;
+  llvm::raw_string_ostream OS(Bitcode);
+  llvm::WriteBitcodeToFile(M.get(), OS);
+  OS.flush();
+  return Bitcode;
+}
+
+bool klang::ReadFunctionBitcode(llvm::Function *F, llvm::StringRef Bitcode) {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer(
+    llvm::MemoryBuffer::getMemBuffer(Bitcode, F->getName(), false));
+  std::string ErrStr;
+  llvm::OwningPtr<llvm::Module> Summary(
+    llvm::ParseBitcodeFile(Buffer.get(), F->getContext(), &ErrStr));
+  if (!Summary)
+    return false;
+
+  // The one definition is the body, even for a function without a name.
+  llvm::Function *Body = 0;
+  for (llvm::Module::iterator G = Summary->begin(), E = Summary->end();
+       G != E; ++G)
+    if (!G->isDeclaration())
+      Body = G;
+  if (!Body || Body->getFunctionType() != F->getFunctionType())
+    return false;
+
+  // deleteBody resets the linkage.
+  llvm::GlobalValue::LinkageTypes Linkage = F->getLinkage();
+  F->deleteBody();
+  F->setLinkage(Linkage);
+
+  llvm::Module *M = F->getParent();
+  llvm::ValueToValueMapTy VMap;
+  VMap[Body] = F;
+  for (llvm::Module::iterator G = Summary->begin(), E = Summary->end();
+       G != E; ++G) {
+    if (&*G == Body)
+      continue;
+    if (M->getFunction(G->getName())) {
+      VMap[G] = M->getOrInsertFunction(G->getName(), G->getFunctionType());
+      continue;
+    }
+
+    // A declaration made here keeps the attributes it was stored with, so
+    // that a hit leaves the same IR as the optimizer would have.
+    llvm::Function *Decl = llvm::Function::Create(
+      G->getFunctionType(), llvm::Function::ExternalLinkage, G->getName(), M);
+    Decl->copyAttributesFrom(G);
+    VMap[G] = Decl;
+  }
+  for (llvm::Module::global_iterator G = Summary->global_begin(),
+       E = Summary->global_end(); G != E; ++G)
+    VMap[G] = M->getOrInsertGlobal(G->getName(),
+                                   G->getType()->getElementType());
+  llvm::Function::arg_iterator DI = F->arg_begin();
+  for (llvm::Function::arg_iterator AI = Body->arg_begin(),
+       AE = Body->arg_end(); AI != AE; ++AI, ++DI) {
+    DI->setName(AI->getName());
+    VMap[AI] = DI;
+  }
+
+  llvm::SmallVector<llvm::ReturnInst*, 4> Returns;
+  llvm::CloneFunctionInto(F, Body, VMap, true, Returns);
+  return true;
+}
@@ -0,0 +1,134 @@
+//===--- OptimizationCache.cpp - --------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the OptimizationCache class.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/CodeGen/OptimizationCache.h"
+#include "klang/CodeGen/FunctionBitcode.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PathV2.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+
+using namespace klang;
+
+
+OptimizationCache::OptimizationCache(llvm::StringRef Dir,
+                                     llvm::StringRef Context)
+  : Dir(Dir), Context(Context), Hits(0), Misses(0), Stores(0) {
+  bool Existed;
+  llvm::sys::fs::create_directories(Dir, Existed);
+}
+
+std::string OptimizationCache::getPath(llvm::StringRef Key) const {
+  llvm::SmallString<128> Path(Dir);
+  llvm::sys::path::append(Path, Key + ".bc");
+  return Path.str();
+}
+
+std::string OptimizationCache::getKey(llvm::Function *F) const {
+  // The function passes read the attributes of the declarations, so they
+  // are part of the key too.
+  std::string IR;
+  llvm::raw_string_ostream OS(IR);
+  llvm::Module *M = F->getParent();
+  for (llvm::Module::iterator G = M->begin(), E = M->end(); G != E; ++G)
+    if (G->isDeclaration())
+      G->print(OS);
+  F->print(OS);
+  OS.flush();
+  return hashKey(IR);
+}
+
+std::string OptimizationCache::hashKey(llvm::StringRef Data) const {
+  // The length of the context keeps it apart from the data.
+  std::string Prefix = llvm::utostr(Context.size()) + ":" + Context;
+  return hashData(Prefix + Data.str());
+}
+
+std::string OptimizationCache::hashData(llvm::StringRef Data) {
+  // The 128-bit FNV-1a hash.  Unlike llvm::hash_value, it is guaranteed to
+  // stay the same from one run, and one build, to the next, and it is wide
+  // enough that a hit can be trusted.  The prime is 2^88 + 0x13b, so the
+  // multiplication is a shift and a small product.
+  uint64_t Hi = 0x6c62272e07bb0142ULL;
+  uint64_t Lo = 0x62b821756295c58dULL;
+  for (unsigned i = 0, e = Data.size(); i != e; ++i) {
+    Lo ^= (unsigned char)Data[i];
+
+    uint64_t P0 = (Lo & 0xffffffffULL) * 0x13b;
+    uint64_t P1 = (Lo >> 32) * 0x13b;
+    uint64_t Mid = (P0 >> 32) + (P1 & 0xffffffffULL);
+    uint64_t Carry = (Mid >> 32) + (P1 >> 32);
+    Hi = Hi * 0x13b + Carry + (Lo << 24);
+    Lo = (Mid << 32) | (P0 & 0xffffffffULL);
+  }
+
+  std::string Key;
+  llvm::raw_string_ostream KeyOS(Key);
+  KeyOS << llvm::format("%016llx%016llx", (unsigned long long)Hi,
+                        (unsigned long long)Lo);
+  return KeyOS.str();
+}
+
+bool OptimizationCache::load(llvm::StringRef Key, llvm::Function *F) {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(getPath(Key), Buffer)) {
+    llvm::sys::AtomicIncrement(&Misses);
+    return false;
+  }
+
+  if (!ReadFunctionBitcode(F, Buffer->getBuffer())) {
+    llvm::sys::AtomicIncrement(&Misses);
+    return false;
+  }
+
+  llvm::sys::AtomicIncrement(&Hits);
+  return true;
+}
+
+void OptimizationCache::store(llvm::StringRef Key, llvm::Function *F) {
+  // Write to a fresh file and rename it into place, so that concurrent runs
+  // never see half an entry.
+  int FD;
+  llvm::SmallString<128> TmpPath;
+  if (llvm::sys::fs::unique_file(getPath(Key) + "-%%%%%%", FD, TmpPath))
+    return;
+
+  bool Failed;
+  {
+    llvm::raw_fd_ostream OS(FD, true);
+    OS << WriteFunctionBitcode(F);
+    OS.close();
+    Failed = OS.has_error();
+    OS.clear_error();
+  }
+
+  if (Failed || llvm::sys::fs::rename(TmpPath.str(), getPath(Key))) {
+    bool Existed;
+    llvm::sys::fs::remove(TmpPath.str(), Existed);
+    return;
+  }
+  llvm::sys::AtomicIncrement(&Stores);
+}
+
+void OptimizationCache::printStats(llvm::raw_ostream &OS) const {
+  OS << "optimization cache: " << Hits << " hits, " << Misses << " misses, "
+     << Stores << " stores\n";
+}
@@ -0,0 +1,146 @@
+//===--- ParallelOptimizer.cpp - --------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the ParallelOptimizer class.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/CodeGen/ParallelOptimizer.h"
+#include "klang/CodeGen/FunctionBitcode.h"
+#include "klang/CodeGen/OptimizationCache.h"
+#include "klang/Frontend/CompilerInstance.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace klang;
+
+
+ParallelOptimizer::ParallelOptimizer(const CompilerInstance &CI,
+                                     unsigned NumThreads,
+                                     OptimizationCache *Cache)
+  : CI(CI), Cache(Cache), Pending(0), Running(true) {
+  pthread_mutex_init(&Lock, 0);
+  pthread_cond_init(&WorkCond, 0);
+  pthread_cond_init(&DoneCond, 0);
+
+  Threads.resize(NumThreads);
+  for (unsigned i = 0; i != NumThreads; ++i)
+    pthread_create(&Threads[i], 0, ThreadMain, this);
+}
+
+ParallelOptimizer::~ParallelOptimizer() {
+  pthread_mutex_lock(&Lock);
+  Running = false;
+  pthread_cond_broadcast(&WorkCond);
+  pthread_mutex_unlock(&Lock);
+
+  for (unsigned i = 0, e = Threads.size(); i != e; ++i)
+    pthread_join(Threads[i], 0);
+
+  for (unsigned i = 0, e = Jobs.size(); i != e; ++i)
+    delete Jobs[i];
+  pthread_cond_destroy(&DoneCond);
+  pthread_cond_destroy(&WorkCond);
+  pthread_mutex_destroy(&Lock);
+}
+
+
+void *ParallelOptimizer::ThreadMain(void *Arg) {
+  static_cast<ParallelOptimizer*>(Arg)->run();
+  return 0;
+}
+
+void ParallelOptimizer::run() {
+  while (1) {
+    pthread_mutex_lock(&Lock);
+    while (Running && Queue.empty())
+      pthread_cond_wait(&WorkCond, &Lock);
+    if (Queue.empty()) {
+      pthread_mutex_unlock(&Lock);
+      return;
+    }
+    Job *J = Queue.front();
+    Queue.pop_front();
+    pthread_mutex_unlock(&Lock);
+
+    optimize(*J);
+
+    pthread_mutex_lock(&Lock);
+    if (--Pending == 0)
+      pthread_cond_signal(&DoneCond);
+    pthread_mutex_unlock(&Lock);
+  }
+}
+
+void ParallelOptimizer::optimize(Job &J) const {
+  // Nothing here may touch the context of the program.  Creating the
+  // pipeline only reads the target and the -O level of CI.
+  llvm::LLVMContext Context;
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer(
+    llvm::MemoryBuffer::getMemBuffer(J.Bitcode, "", false));
+  llvm::OwningPtr<llvm::Module> M(
+    llvm::ParseBitcodeFile(Buffer.get(), Context));
+  if (!M) {
+    J.Failed = true;
+    return;
+  }
+
+  llvm::Function *Body = 0;
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (!F->isDeclaration())
+      Body = F;
+
+  llvm::OwningPtr<llvm::FunctionPassManager> FPM(
+    CI.createFunctionPassManager(M.get()));
+  FPM->run(*Body);
+  FPM.reset();
+
+  J.Bitcode = WriteFunctionBitcode(Body);
+}
+
+
+void ParallelOptimizer::enqueue(llvm::Function *F, const std::string &Key) {
+  Job *J = new Job();
+  J->F = F;
+  J->Key = Key;
+  J->Bitcode = WriteFunctionBitcode(F);
+  J->Failed = false;
+
+  pthread_mutex_lock(&Lock);
+  Jobs.push_back(J);
+  Queue.push_back(J);
+  ++Pending;
+  pthread_cond_signal(&WorkCond);
+  pthread_mutex_unlock(&Lock);
+}
+
+void ParallelOptimizer::join() {
+  pthread_mutex_lock(&Lock);
+  while (Pending)
+    pthread_cond_wait(&DoneCond, &Lock);
+  std::vector<Job*> Done;
+  Done.swap(Jobs);
+  pthread_mutex_unlock(&Lock);
+
+  // A function that failed to come back keeps its unoptimized body, which
+  // is correct, only slower.
+  for (unsigned i = 0, e = Done.size(); i != e; ++i) {
+    Job *J = Done[i];
+    if (!J->Failed && ReadFunctionBitcode(J->F, J->Bitcode) && Cache &&
+        !J->Key.empty())
+      Cache->store(J->Key, J->F);
+    delete J;
+  }
+}
@@ -0,0 +1,310 @@
+//===--- CompilerInstance.cpp - ---------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the CompilerInstance class.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/Frontend/CompilerInstance.h"
+#include "klang/AST/ASTNodes.h"
+#include "klang/CodeGen/DependencyGraph.h"
+#include "klang/CodeGen/FunctionBitcode.h"
+#include "klang/CodeGen/OptimizationCache.h"
+#include "klang/JIT/KlangJIT.h"
+#include "klang/Lex/TokenKinds.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Analysis/Passes.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
+
+using namespace klang;
+
+
+CompilerInstance::CompilerInstance()
+  : TheModule(0), Builder(Context), TailHeader(0), UnboundedLoop(false),
+    TheFPM(0), TheJIT(0),
+    WholeProgram(false), TheTarget(0), Memoize(false), TheOptimizer(0),
+    TheCache(0), TheDeps(0), TheParallelOptimizer(0), OptLevel(-1) {
+  // Install standard binary operators.
+  // 1 is lowest precedence.
+  BinopPrecedence['='] = 2;
+  BinopPrecedence['<'] = 10;
+  BinopPrecedence['+'] = 20;
+  BinopPrecedence['-'] = 20;
+  BinopPrecedence['*'] = 40;  // highest.
+
+  // And the short-circuiting logical ones, below the relationals.
+  BinopPrecedence[(char)tok::tok_oror] = 5;
+  BinopPrecedence[(char)tok::tok_andand] = 6;
+}
+
+CompilerInstance::~CompilerInstance() {
+  delete TheFPM;
+}
+
+
+/// CreatePrototype - Make the prototype of the library function F, as if its
+/// definition had been parsed.  The argument names are lost, so they are made
+/// up.
+static PrototypeAST *CreatePrototype(llvm::Function *F,
+                                     const std::map<char, int> &Precedences) {
+  std::string Name = F->getName();
+  std::vector<std::string> Args;
+  for (unsigned i = 0, e = F->getFunctionType()->getNumParams(); i != e; ++i)
+    Args.push_back("x" + llvm::utostr(i));
+
+  llvm::StringRef N(Name);
+  bool IsUnary = N.size() == 6 && N.startswith("unary");
+  bool IsBinary = N.size() == 7 && N.startswith("binary");
+
+  // Without a recorded precedence, the parser's default one.
+  unsigned Precedence = 30;
+  if (IsBinary) {
+    std::map<char, int>::const_iterator I = Precedences.find(N.back());
+    if (I != Precedences.end())
+      Precedence = I->second;
+  }
+  return new PrototypeAST(Name, Args, IsUnary || IsBinary, Precedence);
+}
+
+PrototypeAST *CompilerInstance::getPrototype(const std::string &Name) {
+  std::map<std::string, PrototypeAST*>::iterator I = FunctionProtos.find(Name);
+  if (I != FunctionProtos.end())
+    return I->second;
+
+  for (unsigned i = 0, e = Libraries.size(); i != e; ++i) {
+    llvm::Function *F = Libraries[i]->getFunction(Name);
+    if (F && !F->isDeclaration() && F->hasExternalLinkage())
+      return FunctionProtos[Name] = CreatePrototype(F, BinopPrecedence);
+  }
+  return 0;
+}
+
+
+/// configurePassManagerBuilder - Set up PMB for OptLevel.
+void CompilerInstance::configurePassManagerBuilder(
+    llvm::PassManagerBuilder &PMB) const {
+  PMB.OptLevel = OptLevel;
+  PMB.SizeLevel = 0;
+  PMB.LoopVectorize = OptLevel > 1;
+  PMB.SLPVectorize = OptLevel > 1;
+  PMB.DisableUnrollLoops = OptLevel == 0;
+  if (OptLevel > 1)
+    PMB.Inliner = llvm::createFunctionInliningPass(OptLevel > 2 ? 275 : 225);
+  else if (OptLevel == 1)
+    PMB.Inliner = llvm::createAlwaysInlinerPass();
+}
+
+llvm::FunctionPassManager *
+CompilerInstance::createFunctionPassManager(llvm::Module *M) const {
+  llvm::FunctionPassManager *FPM = new llvm::FunctionPassManager(M);
+
+  // Set up the optimizer pipeline.  Start with registering info about how
+  // the target lays out data structures.
+  FPM->add(new llvm::DataLayout(*TheTarget->getDataLayout()));
+
+  // With -O the function pipeline only cleans up; the module pipeline does
+  // the real work.
+  if (OptLevel >= 0) {
+    llvm::PassManagerBuilder PMB;
+    configurePassManagerBuilder(PMB);
+    PMB.populateFunctionPassManager(*FPM);
+    delete PMB.Inliner;
+    PMB.Inliner = 0;
+    FPM->doInitialization();
+    return FPM;
+  }
+
+  // Provide basic AliasAnalysis support for GVN.
+  FPM->add(llvm::createBasicAliasAnalysisPass());
+  // Promote allocas to registers.
+  FPM->add(llvm::createPromoteMemoryToRegisterPass());
+  // Do simple "peephole" optimizations and bit-twiddling optzns.
+  FPM->add(llvm::createInstructionCombiningPass());
+  // Reassociate expressions.
+  FPM->add(llvm::createReassociatePass());
+  // Eliminate Common SubExpressions.
+  FPM->add(llvm::createGVNPass());
+  // Simplify the control flow graph (deleting unreachable blocks, etc).
+  FPM->add(llvm::createCFGSimplificationPass());
+
+  FPM->doInitialization();
+  return FPM;
+}
+
+llvm::FunctionPassManager *
+CompilerInstance::createTierPassManager(llvm::Module *M) const {
+  if (OptLevel <= 0)
+    return createFunctionPassManager(M);
+
+  // The module pipeline never sees a tiered function, so the hot tier runs
+  // the scalar passes of -O itself after the early cleanup.
+  llvm::FunctionPassManager *FPM = new llvm::FunctionPassManager(M);
+  FPM->add(new llvm::DataLayout(*TheTarget->getDataLayout()));
+
+  llvm::PassManagerBuilder PMB;
+  configurePassManagerBuilder(PMB);
+  PMB.populateFunctionPassManager(*FPM);
+  delete PMB.Inliner;
+  PMB.Inliner = 0;
+
+  FPM->add(llvm::createBasicAliasAnalysisPass());
+  FPM->add(llvm::createInstructionCombiningPass());
+  FPM->add(llvm::createReassociatePass());
+  FPM->add(llvm::createLoopRotatePass());
+  FPM->add(llvm::createLICMPass());
+  FPM->add(llvm::createIndVarSimplifyPass());
+  if (OptLevel > 1)
+    FPM->add(llvm::createLoopUnrollPass());
+  FPM->add(llvm::createGVNPass());
+  FPM->add(llvm::createInstructionCombiningPass());
+  FPM->add(llvm::createDeadStoreEliminationPass());
+  FPM->add(llvm::createCFGSimplificationPass());
+
+  FPM->doInitialization();
+  return FPM;
+}
+
+llvm::PassManager *CompilerInstance::createModulePassManager() const {
+  if (OptLevel < 0)
+    return 0;
+
+  llvm::PassManager *MPM = new llvm::PassManager();
+  MPM->add(new llvm::DataLayout(*TheTarget->getDataLayout()));
+
+  llvm::PassManagerBuilder PMB;
+  configurePassManagerBuilder(PMB);
+  PMB.populateModulePassManager(*MPM);
+  return MPM;
+}
+
+void CompilerInstance::optimizeModule(llvm::Module *M) {
+  llvm::OwningPtr<llvm::PassManager> MPM(createModulePassManager());
+
+  // Once callees are inlined, cached code is only good for as long as they
+  // are unchanged, so their keys go into the key of each function.  The
+  // graph records every function, even when only the function pipeline
+  // runs, so that the next run can tell what changed.
+  std::vector<std::pair<llvm::Function*, std::string> > Misses;
+  std::vector<llvm::Function*> Hits;
+  if (TheCache && TheDeps) {
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
+      if (F->isDeclaration())
+        continue;
+      std::string Key = TheDeps->addFunction(F, *TheCache, BinopPrecedence);
+      if (!MPM)
+        continue;
+      if (TheCache->load(Key, F))
+        Hits.push_back(F);
+      else
+        Misses.push_back(std::make_pair(&*F, Key));
+    }
+    if (Misses.empty())
+      return;
+  }
+  if (!MPM)
+    return;
+
+  // The JIT knows the bodies of the functions of earlier items.  Lend them
+  // to the inliner, then go back to declarations: the JIT links those to
+  // the code it already has.
+  bool Import = TheJIT && OptLevel > 1;
+  if (Import)
+    TheJIT->importBodies(M);
+
+  // Functions restored from the cache are optimized already.  Their bodies
+  // sit out the pipeline; those left without a caller leave the module for
+  // the time being, so that dead code elimination does not take them.
+  std::vector<std::string> HitBodies;
+  std::vector<llvm::GlobalValue::LinkageTypes> HitLinkages;
+  for (unsigned i = 0, e = Hits.size(); i != e; ++i) {
+    HitBodies.push_back(WriteFunctionBitcode(Hits[i]));
+    HitLinkages.push_back(Hits[i]->getLinkage());
+    Hits[i]->deleteBody();
+  }
+  std::vector<llvm::Function*> Removed;
+  for (unsigned i = 0, e = Hits.size(); i != e; ++i)
+    if (Hits[i]->use_empty()) {
+      Hits[i]->removeFromParent();
+      Removed.push_back(Hits[i]);
+    }
+
+  MPM->run(*M);
+  if (Import)
+    KlangJIT::dropImportedBodies(M);
+
+  for (unsigned i = 0, e = Removed.size(); i != e; ++i)
+    M->getFunctionList().push_back(Removed[i]);
+  for (unsigned i = 0, e = Hits.size(); i != e; ++i) {
+    ReadFunctionBitcode(Hits[i], HitBodies[i]);
+    Hits[i]->setLinkage(HitLinkages[i]);
+  }
+
+  for (unsigned i = 0, e = Misses.size(); i != e; ++i)
+    TheCache->store(Misses[i].second, Misses[i].first);
+}
+
+/// UseFastCalls - Switch the internal functions of M that are only ever
+/// called directly, along with their calls, to the fast calling convention.
+/// Nothing outside the program sees them, so they need not follow the ABI.
+static void UseFastCalls(llvm::Module *M) {
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
+    if (F->isDeclaration() || !F->hasLocalLinkage() || F->hasAddressTaken())
+      continue;
+
+    F->setCallingConv(llvm::CallingConv::Fast);
+    for (llvm::Value::use_iterator UI = F->use_begin(), UE = F->use_end();
+         UI != UE; ++UI)
+      llvm::CallSite(*UI).setCallingConv(llvm::CallingConv::Fast);
+  }
+}
+
+void CompilerInstance::optimizeProgram(
+    llvm::Module *M, const std::vector<const char*> &EntryPoints) {
+  llvm::PassManager MPM;
+  MPM.add(new llvm::DataLayout(*TheTarget->getDataLayout()));
+  MPM.add(llvm::createInternalizePass(EntryPoints));
+
+  if (OptLevel < 0) {
+    // The tutorial pipeline already ran on each function; the program as a
+    // whole still gains from constant propagation across calls, inlining
+    // and dropping what is left unused.
+    MPM.add(llvm::createIPSCCPPass());
+    MPM.add(llvm::createFunctionInliningPass());
+    MPM.add(llvm::createGlobalDCEPass());
+  } else {
+    llvm::PassManagerBuilder PMB;
+    configurePassManagerBuilder(PMB);
+    PMB.populateModulePassManager(MPM);
+  }
+
+  MPM.run(*M);
+  UseFastCalls(M);
+}
+
+void CompilerInstance::initializeModuleAndPassManager() {
+  if (WholeProgram && TheModule)
+    return;
+
+  TheModule = new llvm::Module("klang", Context);
+  TheModule->setTargetTriple(TheTarget->getTargetTriple());
+  TheModule->setDataLayout(
+    TheTarget->getDataLayout()->getStringRepresentation());
+
+  delete TheFPM;
+  TheFPM = createFunctionPassManager(TheModule);
+}
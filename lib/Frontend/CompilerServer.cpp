@@ -0,0 +1,186 @@
+//===--- CompilerServer.cpp - -----------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the compiler server and its client.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/Frontend/CompilerServer.h"
+#include "klang/Frontend/CompilerInstance.h"
+#include "klang/Lex/Lexer.h"
+#include "klang/Parse/Parser.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace klang;
+
+
+/// CreateSocket - Create a Unix stream socket and fill in Addr for Path.
+/// Returns -1 and sets ErrStr on failure.
+static int CreateSocket(llvm::StringRef Path, sockaddr_un &Addr,
+                        std::string &ErrStr) {
+  if (Path.size() >= sizeof(Addr.sun_path)) {
+    ErrStr = "socket path is too long: " + Path.str();
+    return -1;
+  }
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  memcpy(Addr.sun_path, Path.data(), Path.size());
+
+  int Sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Sock < 0)
+    ErrStr = strerror(errno);
+  return Sock;
+}
+
+/// WriteAll - Write the Size bytes at Data to FD.
+static bool WriteAll(int FD, const char *Data, size_t Size) {
+  while (Size) {
+    ssize_t N = ::write(FD, Data, Size);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    Data += N;
+    Size -= N;
+  }
+  return true;
+}
+
+/// ServeConnection - In the child forked for Conn: read the program, run it
+/// with the output going to Conn, and exit.
+static void ServeConnection(CompilerInstance &CI, int Conn) {
+  std::string Source;
+  char Buffer[4096];
+  for (;;) {
+    ssize_t N = ::read(Conn, Buffer, sizeof(Buffer));
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      break;
+    Source.append(Buffer, N);
+  }
+
+  ::dup2(Conn, STDOUT_FILENO);
+  ::dup2(Conn, STDERR_FILENO);
+  ::close(Conn);
+
+  Lexer L(Source);
+  Parser P(CI, L);
+  P.Go();
+
+  // Skip the destructors: the state of the server is not ours to tear down.
+  fflush(stdout);
+  llvm::outs().flush();
+  _exit(0);
+}
+
+void klang::RunServer(CompilerInstance &CI, llvm::StringRef SocketPath,
+                      std::string &ErrStr) {
+  sockaddr_un Addr;
+  int Sock = CreateSocket(SocketPath, Addr, ErrStr);
+  if (Sock < 0)
+    return;
+
+  // A socket left behind by a server that is gone would fail the bind.
+  // Anything else at the path is not ours to remove.
+  struct stat St;
+  if (::lstat(Addr.sun_path, &St) == 0) {
+    if (!S_ISSOCK(St.st_mode)) {
+      ErrStr = SocketPath.str() + ": exists and is not a socket";
+      ::close(Sock);
+      return;
+    }
+    ::unlink(Addr.sun_path);
+  }
+
+  // Whoever connects runs code in the server, so only our user may.
+  mode_t OldMask = ::umask(077);
+  int Bound = ::bind(Sock, (sockaddr *)&Addr, sizeof(Addr));
+  int BindErr = errno;
+  ::umask(OldMask);
+  errno = BindErr;
+  if (Bound < 0 || ::listen(Sock, SOMAXCONN) < 0) {
+    ErrStr = SocketPath.str() + ": " + strerror(errno);
+    ::close(Sock);
+    return;
+  }
+
+  // Nobody waits for the children.
+  ::signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    int Conn = ::accept(Sock, 0, 0);
+    if (Conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      ErrStr = SocketPath.str() + ": " + strerror(errno);
+      break;
+    }
+
+    // Whatever the preludes printed must not come out of every child too.
+    fflush(stdout);
+    llvm::outs().flush();
+
+    pid_t Child = ::fork();
+    if (Child == 0) {
+      ::close(Sock);
+      ServeConnection(CI, Conn);
+    }
+    if (Child < 0) {
+      // The client would otherwise see the connection close without a word.
+      std::string Msg = std::string("klang server: fork: ") + strerror(errno) +
+                        "\n";
+      WriteAll(Conn, Msg.data(), Msg.size());
+    }
+    ::close(Conn);
+  }
+
+  ::close(Sock);
+  ::unlink(Addr.sun_path);
+}
+
+bool klang::RunClient(llvm::StringRef SocketPath, llvm::StringRef Source,
+                      std::string &ErrStr) {
+  sockaddr_un Addr;
+  int Sock = CreateSocket(SocketPath, Addr, ErrStr);
+  if (Sock < 0)
+    return false;
+
+  if (::connect(Sock, (sockaddr *)&Addr, sizeof(Addr)) < 0 ||
+      !WriteAll(Sock, Source.data(), Source.size()) ||
+      ::shutdown(Sock, SHUT_WR) < 0) {
+    ErrStr = SocketPath.str() + ": " + strerror(errno);
+    ::close(Sock);
+    return false;
+  }
+
+  char Buffer[4096];
+  for (;;) {
+    ssize_t N = ::read(Sock, Buffer, sizeof(Buffer));
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      break;
+    llvm::outs().write(Buffer, N);
+    llvm::outs().flush();
+  }
+
+  ::close(Sock);
+  return true;
+}
@@ -0,0 +1,140 @@
+//===--- FrontendUtil.cpp - -------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements helpers for running compilations.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/Frontend/FrontendUtil.h"
+#include "klang/Frontend/CompilerInstance.h"
+#include "klang/Frontend/Prelude.h"
+#include "klang/Lex/Lexer.h"
+#include "klang/Parse/Parser.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Linker.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <pthread.h>
+
+using namespace klang;
+
+
+namespace {
+  /// FileJob - The compilation of one input file.
+  struct FileJob {
+    const CompilerInstance *Parent;
+    llvm::MemoryBuffer *Input;
+    unsigned Index;
+
+    /// Bitcode - The program module of the file.  Modules cannot move
+    /// between contexts, so it travels back to the parent as bitcode.
+    std::string Bitcode;
+
+    /// ExprNames - The names given to the top-level expressions, in order.
+    std::vector<std::string> ExprNames;
+  };
+}
+
+/// CompileFile - Thread entry point: compile the FileJob at Arg.
+static void *CompileFile(void *Arg) {
+  FileJob &J = *static_cast<FileJob*>(Arg);
+
+  // The file is a compilation of its own.  It only reads the target of the
+  // parent, and the cache is safe to share.  It starts out knowing what the
+  // parent knew before the files, such as the functions of a prelude.
+  CompilerInstance CI;
+  CI.TheTarget = J.Parent->TheTarget;
+  CI.OptLevel = J.Parent->OptLevel;
+  CI.TheCache = J.Parent->TheCache;
+  CI.WholeProgram = true;
+  CI.FunctionProtos = J.Parent->FunctionProtos;
+  CI.BinopPrecedence = J.Parent->BinopPrecedence;
+  CI.PureFunctions = J.Parent->PureFunctions;
+  CI.TerminatingFunctions = J.Parent->TerminatingFunctions;
+  CI.Memoize = J.Parent->Memoize;
+
+  // The modules of the parent's libraries live in the parent's context, and
+  // reading a body changes them, so every file reads the bitcode again.  The
+  // parent has read the same bitcode already, so this does not fail.
+  for (unsigned i = 0, e = J.Parent->Libraries.size(); i != e; ++i) {
+    std::map<llvm::Module*, llvm::StringRef>::const_iterator I =
+      J.Parent->LibraryBitcode.find(J.Parent->Libraries[i]);
+    if (I == J.Parent->LibraryBitcode.end())
+      continue;
+    std::string ErrStr;
+    LoadPrelude(CI, llvm::MemoryBuffer::getMemBuffer(
+                      I->second, J.Parent->Libraries[i]->getModuleIdentifier(),
+                      false),
+                ErrStr);
+  }
+
+  Lexer L(J.Input->getBuffer());
+  Parser P(CI, L);
+  P.Go();
+
+  // An empty file still gets a module.
+  CI.initializeModuleAndPassManager();
+
+  // The expressions are anonymous; give them names that survive linking.
+  const std::vector<llvm::Function*> &Exprs = P.getTopLevelExprs();
+  for (unsigned i = 0, e = Exprs.size(); i != e; ++i) {
+    Exprs[i]->setName("__klang_file" + llvm::utostr(J.Index) + "_expr" +
+                      llvm::utostr(i));
+    J.ExprNames.push_back(Exprs[i]->getName());
+  }
+
+  llvm::raw_string_ostream OS(J.Bitcode);
+  llvm::WriteBitcodeToFile(CI.TheModule, OS);
+  OS.flush();
+
+  delete CI.TheModule;
+  CI.TheModule = 0;
+  llvm::DeleteContainerPointers(CI.Libraries);
+  return 0;
+}
+
+bool klang::CompileFiles(CompilerInstance &CI,
+                         const std::vector<llvm::MemoryBuffer*> &Inputs,
+                         std::vector<llvm::Function*> &Exprs,
+                         std::string &ErrStr) {
+  std::vector<FileJob> Jobs(Inputs.size());
+  std::vector<pthread_t> Threads(Inputs.size());
+  for (unsigned i = 0, e = Inputs.size(); i != e; ++i) {
+    Jobs[i].Parent = &CI;
+    Jobs[i].Input = Inputs[i];
+    Jobs[i].Index = i;
+    pthread_create(&Threads[i], 0, CompileFile, &Jobs[i]);
+  }
+  for (unsigned i = 0, e = Threads.size(); i != e; ++i)
+    pthread_join(Threads[i], 0);
+
+  CI.initializeModuleAndPassManager();
+  for (unsigned i = 0, e = Jobs.size(); i != e; ++i) {
+    llvm::OwningPtr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer(Jobs[i].Bitcode, "", false));
+    llvm::OwningPtr<llvm::Module> M(
+      llvm::ParseBitcodeFile(Buffer.get(), CI.getContext(), &ErrStr));
+    if (!M || llvm::Linker::LinkModules(CI.TheModule, M.get(),
+                                        llvm::Linker::DestroySource,
+                                        &ErrStr)) {
+      ErrStr = Inputs[i]->getBufferIdentifier() + std::string(": ") + ErrStr;
+      return false;
+    }
+
+    for (unsigned j = 0, je = Jobs[i].ExprNames.size(); j != je; ++j)
+      Exprs.push_back(CI.TheModule->getFunction(Jobs[i].ExprNames[j]));
+  }
+  return true;
+}
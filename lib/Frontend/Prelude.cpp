@@ -0,0 +1,123 @@
+//===--- Prelude.cpp - ------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the reading and writing of precompiled
+/// preludes.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/Frontend/Prelude.h"
+#include "klang/Frontend/CompilerInstance.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace klang;
+
+
+/// OperatorsMD - The named metadata holding the operator precedences.  Each
+/// operand is a pair of the function name and the precedence.
+static const char *const OperatorsMD = "klang.operators";
+
+void klang::RecordOperators(const CompilerInstance &CI, llvm::Module *M) {
+  llvm::LLVMContext &Context = M->getContext();
+  llvm::NamedMDNode *Operators = M->getOrInsertNamedMetadata(OperatorsMD);
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
+    llvm::StringRef Name = F->getName();
+    if (F->isDeclaration() || Name.size() != 7 || !Name.startswith("binary"))
+      continue;
+
+    std::map<char, int>::const_iterator I =
+      CI.BinopPrecedence.find(Name.back());
+    if (I == CI.BinopPrecedence.end())
+      continue;
+
+    llvm::Value *Ops[] = {
+      llvm::MDString::get(Context, Name),
+      llvm::ConstantInt::get(llvm::Type::getInt32Ty(Context), I->second)
+    };
+    Operators->addOperand(llvm::MDNode::get(Context, Ops));
+  }
+}
+
+/// PureMD, TerminatingMD - The named metadata listing the names of the pure
+/// functions, and of those known to return.
+static const char *const PureMD = "klang.pure";
+static const char *const TerminatingMD = "klang.terminating";
+
+/// RecordNames - List in the named metadata MDName of M the functions M
+/// defines that are in Names.
+static void RecordNames(llvm::Module *M, const char *MDName,
+                        const std::set<std::string> &Names) {
+  llvm::NamedMDNode *Node = M->getOrInsertNamedMetadata(MDName);
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (!F->isDeclaration() && Names.count(F->getName())) {
+      llvm::Value *Name = llvm::MDString::get(M->getContext(), F->getName());
+      Node->addOperand(llvm::MDNode::get(M->getContext(), Name));
+    }
+}
+
+/// ReadNames - Add to Names the functions listed in the named metadata
+/// MDName of M.
+static void ReadNames(llvm::Module *M, const char *MDName,
+                      std::set<std::string> &Names) {
+  llvm::NamedMDNode *Node = M->getNamedMetadata(MDName);
+  if (!Node)
+    return;
+  for (unsigned i = 0, e = Node->getNumOperands(); i != e; ++i)
+    if (llvm::MDString *Name =
+          llvm::dyn_cast<llvm::MDString>(Node->getOperand(i)->getOperand(0)))
+      Names.insert(Name->getString());
+}
+
+void klang::RecordPurity(const CompilerInstance &CI, llvm::Module *M) {
+  RecordNames(M, PureMD, CI.PureFunctions);
+
+  // A memoized function writes its table, so its callers must not take it
+  // for readnone.
+  if (!CI.Memoize)
+    RecordNames(M, TerminatingMD, CI.TerminatingFunctions);
+}
+
+llvm::Module *klang::LoadPrelude(CompilerInstance &CI,
+                                 llvm::MemoryBuffer *Buffer,
+                                 std::string &ErrStr) {
+  llvm::Module *M =
+    llvm::getLazyBitcodeModule(Buffer, CI.getContext(), &ErrStr);
+  if (!M) {
+    delete Buffer;
+    return 0;
+  }
+
+  // Only the operators are installed up front, since the parser needs their
+  // precedences, along with the names of the pure functions.  Prototypes are
+  // made when a function is first used.
+  if (llvm::NamedMDNode *Operators = M->getNamedMetadata(OperatorsMD))
+    for (unsigned i = 0, e = Operators->getNumOperands(); i != e; ++i) {
+      llvm::MDNode *Op = Operators->getOperand(i);
+      llvm::MDString *Name = llvm::dyn_cast<llvm::MDString>(Op->getOperand(0));
+      llvm::ConstantInt *Prec =
+        llvm::dyn_cast<llvm::ConstantInt>(Op->getOperand(1));
+      if (Name && Prec && Name->getLength() == 7)
+        CI.BinopPrecedence[Name->getString().back()] = Prec->getZExtValue();
+    }
+
+  // Calls to the pure functions of the prelude may still be folded, hoisted
+  // and deleted.
+  ReadNames(M, PureMD, CI.PureFunctions);
+  ReadNames(M, TerminatingMD, CI.TerminatingFunctions);
+
+  CI.Libraries.push_back(M);
+  CI.LibraryBitcode[M] = Buffer->getBuffer();
+  return M;
+}
@@ -0,0 +1,273 @@
+//===--- BackgroundOptimizer.cpp - ------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the BackgroundOptimizer class.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/JIT/BackgroundOptimizer.h"
+#include "klang/Frontend/CompilerInstance.h"
+#include "klang/JIT/KlangJIT.h"
+#include "klang/JIT/OSREntry.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/Atomic.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace klang;
+
+
+BackgroundOptimizer::BackgroundOptimizer(CompilerInstance &CI)
+  : CI(CI), JIT(*CI.TheJIT),
+    DefaultFastISel(JIT.getTargetMachine().Options.EnableFastISel),
+    Running(false) {
+  pthread_mutex_init(&QueueLock, 0);
+  pthread_cond_init(&QueueCond, 0);
+}
+
+BackgroundOptimizer::~BackgroundOptimizer() {
+  stop();
+  pthread_cond_destroy(&QueueCond);
+  pthread_mutex_destroy(&QueueLock);
+
+  // The JIT outlives us, but no code runs any more.
+  for (llvm::DenseMap<llvm::Module*, std::vector<void**> >::iterator
+       I = OSRSlots.begin(), E = OSRSlots.end(); I != E; ++I)
+    for (unsigned i = 0, e = I->second.size(); i != e; ++i)
+      delete I->second[i];
+}
+
+
+void BackgroundOptimizer::start() {
+  if (Running)
+    return;
+  Running = true;
+  pthread_create(&Thread, 0, ThreadMain, this);
+}
+
+void BackgroundOptimizer::stop() {
+  pthread_mutex_lock(&QueueLock);
+  bool WasRunning = Running;
+  Running = false;
+  Queue.clear();
+  pthread_cond_signal(&QueueCond);
+  pthread_mutex_unlock(&QueueLock);
+
+  if (WasRunning)
+    pthread_join(Thread, 0);
+}
+
+
+void *BackgroundOptimizer::ThreadMain(void *Arg) {
+  static_cast<BackgroundOptimizer*>(Arg)->run();
+  return 0;
+}
+
+void BackgroundOptimizer::run() {
+  while (1) {
+    pthread_mutex_lock(&QueueLock);
+    while (Running && Queue.empty())
+      pthread_cond_wait(&QueueCond, &QueueLock);
+    bool Stopping = !Running;
+    pthread_mutex_unlock(&QueueLock);
+    if (Stopping)
+      return;
+
+    // Take the job only once the compiler is ours: while the parser holds the
+    // lock it may drop the jobs of a module it frees.  The running program
+    // compiles functions on their first call with the lock of the JIT held,
+    // in the same context, so take that one too.
+    llvm::MutexGuard Locked(CI.CompilerLock);
+    llvm::MutexGuard JITLocked(JIT.getLock());
+    Job J;
+    if (takeJob(J))
+      optimize(J);
+  }
+}
+
+bool BackgroundOptimizer::takeJob(Job &J) {
+  pthread_mutex_lock(&QueueLock);
+  bool Found = Running && !Queue.empty();
+  if (Found) {
+    J = Queue.front();
+    Queue.pop_front();
+  }
+  pthread_mutex_unlock(&QueueLock);
+  return Found;
+}
+
+void BackgroundOptimizer::optimize(const Job &J) {
+  llvm::OwningPtr<llvm::FunctionPassManager> FPM(
+    CI.createTierPassManager(J.Body->getParent()));
+  FPM->run(*J.Body);
+
+  JIT.getTargetMachine().Options.EnableFastISel = DefaultFastISel;
+  void *Code = JIT.getPointerToFunction(J.Body);
+
+  // Make the new code visible before publishing its address.  Callers load
+  // the slot on every call, so from here on they run the optimized body.
+  llvm::sys::MemoryFence();
+  *J.Target = Code;
+}
+
+void BackgroundOptimizer::enqueue(llvm::Function *Body,
+                                  void *volatile *Target) {
+  Job J = { Body, Target };
+
+  pthread_mutex_lock(&QueueLock);
+  Queue.push_back(J);
+  pthread_cond_signal(&QueueCond);
+  pthread_mutex_unlock(&QueueLock);
+}
+
+
+llvm::GlobalVariable *BackgroundOptimizer::createSlot(llvm::Function *F) {
+  // A redefinition takes over the slot of the earlier definition, so that
+  // its callers run the new body.
+  if (Slots.count(F->getName()))
+    return getSlot(F);
+
+  // The slot is external, so that the JIT can link the modules of later
+  // items to it.
+  llvm::GlobalVariable *Slot = new llvm::GlobalVariable(
+    *F->getParent(),
+    F->getType(),
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    llvm::Constant::getNullValue(F->getType()),
+    F->getName() + ".slot");
+  Slots[F->getName()] = Slot;
+  return Slot;
+}
+
+llvm::GlobalVariable *BackgroundOptimizer::getSlot(llvm::Function *F) {
+  llvm::GlobalVariable *Slot = Slots.lookup(F->getName());
+  if (!Slot || Slot->getParent() == F->getParent())
+    return Slot;
+
+  llvm::Module *M = F->getParent();
+  if (llvm::GlobalVariable *Decl = M->getGlobalVariable(Slot->getName()))
+    return Decl;
+  return new llvm::GlobalVariable(
+    *M,
+    F->getType(),
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    0,
+    Slot->getName());
+}
+
+void BackgroundOptimizer::forgetFunction(llvm::Function *F) {
+  LoopHeaders.clear();
+
+  llvm::StringMap<llvm::GlobalVariable*>::iterator I =
+    Slots.find(F->getName());
+  if (I == Slots.end() || I->second->getParent() != F->getParent())
+    return;
+  I->second->eraseFromParent();
+  Slots.erase(I);
+}
+
+void BackgroundOptimizer::addFunction(llvm::Function *F) {
+  // Build the loop continuations and the optimized copy while F is still
+  // free of on-stack replacement checks.  A top-level expression has no
+  // slot and is never called again, so it gets no optimized copy; its loops
+  // still get continuations, since a long loop in code that runs once is
+  // what on-stack replacement is for.
+  llvm::Function *Clone = 0;
+  llvm::GlobalVariable *Slot = getSlot(F);
+  std::vector<OSREntry> Entries;
+  for (unsigned i = 0, e = LoopHeaders.size(); i != e; ++i) {
+    OSREntry Entry;
+    if (CreateOSRContinuation(F, LoopHeaders[i], Entry))
+      Entries.push_back(Entry);
+  }
+  LoopHeaders.clear();
+
+  if (Slot) {
+    // Optimize a copy, so the quick body stays intact for the frames that
+    // are still running it.
+    llvm::ValueToValueMapTy VMap;
+    Clone = llvm::CloneFunction(F, VMap, false);
+    Clone->setName(F->getName() + ".opt");
+    F->getParent()->getFunctionList().push_back(Clone);
+  }
+
+  std::vector<void**> Targets;
+  for (unsigned i = 0, e = Entries.size(); i != e; ++i) {
+    llvm::Function *G = Entries[i].Continuation;
+    llvm::GlobalVariable *OSRSlot = new llvm::GlobalVariable(
+      *F->getParent(),
+      G->getType(),
+      false,
+      llvm::GlobalValue::InternalLinkage,
+      llvm::Constant::getNullValue(G->getType()),
+      G->getName() + ".slot");
+    InsertOSRCheck(Entries[i], OSRSlot);
+
+    void **Target = new void*(0);
+    JIT.mapGlobal(OSRSlot, Target);
+    OSRSlots[F->getParent()].push_back(Target);
+    Targets.push_back(Target);
+  }
+
+  // Quick tier: the body is unoptimized and instruction selection takes the
+  // fast path.
+  llvm::TargetMachine &TM = JIT.getTargetMachine();
+  TM.Options.EnableFastISel = true;
+  void *Code = JIT.getPointerToFunction(F);
+  TM.Options.EnableFastISel = DefaultFastISel;
+
+  if (Slot) {
+    // An optimized body of an earlier definition must not land in the slot
+    // after this one.
+    void *volatile *Target = (void *volatile *)JIT.getPointerToGlobal(Slot);
+    dropJobs(Target);
+    *Target = Code;
+    enqueue(Clone, Target);
+  }
+
+  for (unsigned i = 0, e = Entries.size(); i != e; ++i)
+    enqueue(Entries[i].Continuation, Targets[i]);
+}
+
+void BackgroundOptimizer::dropJobs(void *volatile *Target) {
+  pthread_mutex_lock(&QueueLock);
+  for (std::deque<Job>::iterator I = Queue.begin(); I != Queue.end(); )
+    if (I->Target == Target)
+      I = Queue.erase(I);
+    else
+      ++I;
+  pthread_mutex_unlock(&QueueLock);
+}
+
+void BackgroundOptimizer::forgetModule(llvm::Module *M) {
+  pthread_mutex_lock(&QueueLock);
+  for (std::deque<Job>::iterator I = Queue.begin(); I != Queue.end(); )
+    if (I->Body->getParent() == M)
+      I = Queue.erase(I);
+    else
+      ++I;
+  pthread_mutex_unlock(&QueueLock);
+
+  llvm::DenseMap<llvm::Module*, std::vector<void**> >::iterator SI =
+    OSRSlots.find(M);
+  if (SI == OSRSlots.end())
+    return;
+  for (unsigned i = 0, e = SI->second.size(); i != e; ++i)
+    delete SI->second[i];
+  OSRSlots.erase(SI);
+}
@@ -0,0 +1,423 @@
+//===--- KlangJIT.cpp - -----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements the KlangJIT class.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/JIT/KlangJIT.h"
+#include "klang/CodeGen/FunctionBitcode.h"
+#include "llvm/ExecutionEngine/JIT.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Target/TargetMachine.h"
+#include <algorithm>
+
+using namespace klang;
+
+
+/// EmissionListener - Record the functions the JIT emits, so that their
+/// bodies can be deleted once the code generator is done with them.
+class KlangJIT::EmissionListener : public llvm::JITEventListener {
+  KlangJIT &JIT;
+
+public:
+  explicit EmissionListener(KlangJIT &JIT) : JIT(JIT) {}
+
+  virtual void NotifyFunctionEmitted(const llvm::Function &F, void *Code,
+                                     size_t Size,
+                                     const EmittedFunctionDetails &Details) {
+    if (!JIT.DiscardIR)
+      return;
+    llvm::MutexGuard Locked(JIT.EmittedLock);
+    JIT.Emitted.push_back(const_cast<llvm::Function*>(&F));
+  }
+};
+
+
+KlangJIT::KlangJIT(llvm::ExecutionEngine *EE, llvm::TargetMachine &TM)
+  : EE(EE), TM(TM), Listener(new EmissionListener(*this)), StubModule(0),
+    Redefinable(false), DiscardIR(false) {
+  // Calls into another function go through a stub that compiles the callee
+  // the first time it runs.
+  EE->DisableLazyCompilation(false);
+  EE->RegisterJITEventListener(Listener.get());
+}
+
+KlangJIT::~KlangJIT() {
+  EE->UnregisterJITEventListener(Listener.get());
+}
+
+KlangJIT *KlangJIT::create(llvm::LLVMContext &Context, std::string &ErrStr) {
+  // The JIT keeps its code generator bound to its first module, so give it
+  // one that is never removed.
+  llvm::Module *Base = new llvm::Module("klang", Context);
+
+  llvm::EngineBuilder EB(Base);
+  EB.setErrorStr(&ErrStr);
+  EB.setEngineKind(llvm::EngineKind::JIT);
+
+  // Keep hold of the target: tiered execution switches its instruction
+  // selector per function.
+  llvm::TargetMachine *TM = EB.selectTarget();
+  if (!TM) {
+    delete Base;
+    return 0;
+  }
+
+  llvm::ExecutionEngine *EE = EB.create(TM);
+  if (!EE)
+    return 0;
+
+  return new KlangJIT(EE, *TM);
+}
+
+
+llvm::GlobalValue *KlangJIT::findSymbol(llvm::StringRef Name) const {
+  if (llvm::GlobalValue *GV = Symbols.lookup(Name))
+    return GV;
+
+  for (unsigned i = 0, e = Libraries.size(); i != e; ++i) {
+    llvm::GlobalValue *GV = Libraries[i]->getNamedValue(Name);
+    if (GV && !GV->isDeclaration() && GV->hasExternalLinkage())
+      return GV;
+  }
+  return 0;
+}
+
+void KlangJIT::resolve(llvm::GlobalValue *Decl, llvm::GlobalValue *Def) {
+  void *Addr;
+  if (llvm::Function *F = llvm::dyn_cast<llvm::Function>(Def))
+    Addr = EE->getPointerToFunctionOrStub(F);
+  else
+    Addr = EE->getPointerToGlobal(Def);
+  EE->updateGlobalMapping(Decl, Addr);
+}
+
+void KlangJIT::link(llvm::GlobalValue *Decl) {
+  if (llvm::GlobalValue *Def = findSymbol(Decl->getName()))
+    resolve(Decl, Def);
+  else
+    Unresolved[Decl->getName()].push_back(Decl);
+}
+
+void KlangJIT::define(llvm::GlobalValue *Def) {
+  Symbols[Def->getName()] = Def;
+
+  llvm::StringMap<std::vector<llvm::GlobalValue*> >::iterator I =
+    Unresolved.find(Def->getName());
+  if (I == Unresolved.end())
+    return;
+  for (unsigned i = 0, e = I->second.size(); i != e; ++i)
+    resolve(I->second[i], Def);
+  Unresolved.erase(I);
+}
+
+void KlangJIT::forget(llvm::GlobalValue *GV) {
+  if (!GV->hasName())
+    return;
+
+  // A definition whose body was discarded looks like a declaration, so look
+  // it up in the symbol table first.
+  llvm::StringMap<llvm::GlobalValue*>::iterator SI =
+    Symbols.find(GV->getName());
+  if (SI != Symbols.end() && SI->second == GV) {
+    Symbols.erase(SI);
+    return;
+  }
+  if (!GV->isDeclaration())
+    return;
+
+  llvm::StringMap<std::vector<llvm::GlobalValue*> >::iterator I =
+    Unresolved.find(GV->getName());
+  if (I == Unresolved.end())
+    return;
+  std::vector<llvm::GlobalValue*> &Decls = I->second;
+  Decls.erase(std::remove(Decls.begin(), Decls.end(), GV), Decls.end());
+  if (Decls.empty())
+    Unresolved.erase(I);
+}
+
+
+void KlangJIT::discardEmittedIR() {
+  std::vector<llvm::Function*> Discard;
+  {
+    llvm::MutexGuard Locked(EmittedLock);
+    Discard.swap(Emitted);
+  }
+
+  for (unsigned i = 0, e = Discard.size(); i != e; ++i) {
+    llvm::Function *F = Discard[i];
+    if (F->isDeclaration())
+      continue;
+
+    // Only the visible definition of a name can be needed again, by callers
+    // in later modules.  Tier copies and loop continuations just go.
+    if (F->hasName() && findSymbol(F->getName()) == F &&
+        !Summaries.count(F))
+      Summaries[F] = WriteFunctionBitcode(F);
+
+    // deleteBody makes F external, which is what findSymbol still expects.
+    F->deleteBody();
+  }
+}
+
+bool KlangJIT::rematerialize(llvm::Function *F) {
+  llvm::DenseMap<const llvm::Function*, std::string>::iterator I =
+    Summaries.find(F);
+  if (I == Summaries.end() || !F->isDeclaration())
+    return false;
+
+  if (!ReadFunctionBitcode(F, I->second))
+    return false;
+
+  // The machine code is still current; the body goes again with the next
+  // batch of emitted functions.
+  if (DiscardIR) {
+    llvm::MutexGuard Locked(EmittedLock);
+    Emitted.push_back(F);
+  }
+  return true;
+}
+
+llvm::GlobalVariable *KlangJIT::getStub(llvm::Function *F) {
+  llvm::GlobalVariable *Stub = Stubs.lookup(F->getName());
+  if (!Stub || Stub->getParent() == F->getParent())
+    return Stub;
+
+  // Declare the stub; addModule links the declaration to it.
+  llvm::Module *M = F->getParent();
+  if (llvm::GlobalVariable *Decl = M->getGlobalVariable(Stub->getName()))
+    return Decl;
+  return new llvm::GlobalVariable(
+    *M,
+    F->getType(),
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    0,
+    Stub->getName());
+}
+
+void KlangJIT::declareFunction(llvm::StringRef Name,
+                               llvm::LLVMContext &Context) {
+  if (!Redefinable || Stubs.count(Name) || findSymbol(Name) ||
+      llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(Name))
+    return;
+
+  if (!StubModule) {
+    StubModule = new llvm::Module("klang.stubs", Context);
+    EE->addModule(StubModule);
+  }
+
+  // Stubs are linked by address, so the type does not matter.  The first
+  // definition of Name fills it in.
+  llvm::PointerType *Int8PtrTy = llvm::Type::getInt8PtrTy(Context);
+  llvm::GlobalVariable *Stub = new llvm::GlobalVariable(
+    *StubModule,
+    Int8PtrTy,
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    llvm::Constant::getNullValue(Int8PtrTy),
+    Name + ".stub");
+  Stubs[Name] = Stub;
+  define(Stub);
+}
+
+void KlangJIT::importBodies(llvm::Module *M) {
+  // Imported bodies may declare more functions; those are not imported in
+  // turn, the inliner would rarely get that deep.
+  std::vector<llvm::Function*> Decls;
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (F->isDeclaration() && F->hasName() && !F->isIntrinsic())
+      Decls.push_back(F);
+
+  for (unsigned i = 0, e = Decls.size(); i != e; ++i) {
+    llvm::Function *Def =
+      llvm::dyn_cast_or_null<llvm::Function>(findSymbol(Decls[i]->getName()));
+    if (!Def)
+      continue;
+
+    // A body still in the bitcode of a lazily read module is read now, and
+    // a discarded one is restored from its summary.
+    if (Def->isMaterializable() && Def->Materialize())
+      continue;
+    if (Def->isDeclaration() && !rematerialize(Def))
+      continue;
+
+    if (ReadFunctionBitcode(Decls[i], WriteFunctionBitcode(Def)))
+      Decls[i]->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+  }
+}
+
+llvm::Module *KlangJIT::createSnapshot(llvm::LLVMContext &Context) {
+  llvm::Module *M = new llvm::Module("klang", Context);
+  M->setTargetTriple(TM.getTargetTriple());
+  M->setDataLayout(getDataLayout()->getStringRepresentation());
+
+  for (llvm::StringMap<llvm::GlobalValue*>::iterator I = Symbols.begin(),
+       E = Symbols.end(); I != E; ++I) {
+    llvm::Function *F = llvm::dyn_cast<llvm::Function>(I->second);
+    if (!F)
+      continue;
+
+    if (F->isDeclaration() && !rematerialize(F))
+      continue;
+
+    // An earlier body may have declared F already.
+    llvm::Function *Copy = llvm::cast<llvm::Function>(
+      M->getOrInsertFunction(F->getName(), F->getFunctionType()));
+    ReadFunctionBitcode(Copy, WriteFunctionBitcode(F));
+  }
+
+  // Every name has one definition now, so call it directly.
+  for (llvm::Module::global_iterator G = M->global_begin(),
+       E = M->global_end(); G != E; ) {
+    llvm::GlobalVariable *Stub = G++;
+    llvm::StringRef Name = Stub->getName();
+    if (!Name.endswith(".stub"))
+      continue;
+
+    llvm::PointerType *FPtr =
+      llvm::cast<llvm::PointerType>(Stub->getType()->getElementType());
+    llvm::Constant *Callee = M->getOrInsertFunction(
+      Name.substr(0, Name.size() - 5),
+      llvm::cast<llvm::FunctionType>(FPtr->getElementType()));
+
+    std::vector<llvm::User*> Users(Stub->use_begin(), Stub->use_end());
+    for (unsigned i = 0, e = Users.size(); i != e; ++i)
+      if (llvm::LoadInst *Load = llvm::dyn_cast<llvm::LoadInst>(Users[i])) {
+        Load->replaceAllUsesWith(Callee);
+        Load->eraseFromParent();
+      }
+    if (Stub->use_empty())
+      Stub->eraseFromParent();
+  }
+  return M;
+}
+
+void KlangJIT::dropImportedBodies(llvm::Module *M) {
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (F->hasAvailableExternallyLinkage())
+      F->deleteBody();
+}
+
+
+KlangJIT::ModuleHandle KlangJIT::addModule(llvm::Module *M) {
+  discardEmittedIR();
+
+  // The first definition of a name creates its call stub; a redefinition
+  // takes it over.
+  std::vector<llvm::Function*> Stubbed;
+  if (Redefinable)
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
+      if (F->isDeclaration() || !F->hasExternalLinkage() || !F->hasName())
+        continue;
+      if (!Stubs.count(F->getName()))
+        Stubs[F->getName()] = new llvm::GlobalVariable(
+          *M,
+          F->getType(),
+          false,
+          llvm::GlobalValue::ExternalLinkage,
+          llvm::Constant::getNullValue(F->getType()),
+          F->getName() + ".stub");
+      Stubbed.push_back(F);
+    }
+
+  EE->addModule(M);
+
+  // Link the declarations of M to earlier definitions, then publish the
+  // definitions of M, which may complete declarations of earlier modules.
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (F->isDeclaration() && F->hasName() && !F->isIntrinsic())
+      link(F);
+  for (llvm::Module::global_iterator G = M->global_begin(),
+       E = M->global_end(); G != E; ++G)
+    if (G->isDeclaration())
+      link(G);
+
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (!F->isDeclaration() && F->hasExternalLinkage() && F->hasName())
+      define(F);
+  for (llvm::Module::global_iterator G = M->global_begin(),
+       E = M->global_end(); G != E; ++G)
+    if (!G->isDeclaration() && G->hasExternalLinkage())
+      define(G);
+
+  // Point the stubs at the new definitions.  As with a direct call, the
+  // function is compiled the first time a caller goes through its stub.
+  for (unsigned i = 0, e = Stubbed.size(); i != e; ++i) {
+    llvm::Function *F = Stubbed[i];
+    void *volatile *Stub =
+      (void *volatile *)EE->getPointerToGlobal(Stubs[F->getName()]);
+    *Stub = EE->getPointerToFunctionOrStub(F);
+  }
+
+  return M;
+}
+
+void KlangJIT::addLibrary(llvm::Module *M) {
+  EE->addModule(M);
+  Libraries.push_back(M);
+
+  // The legacy JIT cannot look a name up in another module, so the
+  // declarations of M are linked like those of addModule, such as a saved
+  // session calling into the prelude it was run with.  A function whose
+  // body is still in the bitcode is not a declaration, so nothing is read.
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (F->isDeclaration() && F->hasName() && !F->isIntrinsic())
+      link(F);
+  for (llvm::Module::global_iterator G = M->global_begin(),
+       E = M->global_end(); G != E; ++G)
+    if (G->isDeclaration())
+      link(G);
+
+  // Earlier declarations of a name M defines, such as those of a library
+  // included ahead of the one it calls into, are linked now.
+  std::vector<std::string> Names;
+  for (llvm::StringMap<std::vector<llvm::GlobalValue*> >::iterator
+       I = Unresolved.begin(), E = Unresolved.end(); I != E; ++I)
+    Names.push_back(I->getKey());
+  for (unsigned i = 0, e = Names.size(); i != e; ++i) {
+    llvm::GlobalValue *Def = findSymbol(Names[i]);
+    if (!Def)
+      continue;
+    std::vector<llvm::GlobalValue*> &Decls = Unresolved[Names[i]];
+    for (unsigned j = 0, je = Decls.size(); j != je; ++j)
+      resolve(Decls[j], Def);
+    Unresolved.erase(Names[i]);
+  }
+}
+
+void KlangJIT::removeModule(ModuleHandle H) {
+  llvm::Module *M = H;
+  discardEmittedIR();
+
+  for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
+    // Machine code outlives a discarded body, so free it either way.
+    EE->freeMachineCodeForFunction(F);
+    Summaries.erase(F);
+    forget(F);
+  }
+  for (llvm::Module::global_iterator G = M->global_begin(),
+       E = M->global_end(); G != E; ++G)
+    forget(G);
+
+  EE->removeModule(M);
+  delete M;
+}
@@ -0,0 +1,231 @@
+//===--- OSREntry.cpp - -----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief This file implements on-stack replacement entry points.
+///
+/// Unoptimized klang code keeps every variable in an entry block alloca, so
+/// the state of a function at a loop header is the contents of its allocas
+/// plus the few temporaries that are computed before the loop and used after
+/// it.  The continuation takes exactly those as arguments.
+///
+//===----------------------------------------------------------------------===//
+
+#include "klang/JIT/OSREntry.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/Verifier.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace klang;
+
+
+/// CollectReachable - Collect every block reachable from Start.
+static void CollectReachable(llvm::BasicBlock *Start,
+                             llvm::SmallPtrSet<llvm::BasicBlock*, 32> &Blocks) {
+  llvm::SmallVector<llvm::BasicBlock*, 32> Worklist;
+  Worklist.push_back(Start);
+  while (!Worklist.empty()) {
+    llvm::BasicBlock *BB = Worklist.pop_back_val();
+    if (!Blocks.insert(BB))
+      continue;
+    for (llvm::succ_iterator SI = llvm::succ_begin(BB), SE = llvm::succ_end(BB);
+         SI != SE; ++SI)
+      Worklist.push_back(*SI);
+  }
+}
+
+/// CollectLiveIns - Collect the values defined outside Region and used inside
+/// it.  Returns false if one of them is not a double or a double variable.
+static bool CollectLiveIns(llvm::Function *F,
+                           llvm::SmallPtrSet<llvm::BasicBlock*, 32> &Region,
+                           std::vector<llvm::Value*> &LiveIns) {
+  llvm::SmallPtrSet<llvm::Value*, 16> Seen;
+
+  for (llvm::Function::iterator FI = F->begin(), FE = F->end(); FI != FE;
+       ++FI) {
+    llvm::BasicBlock *BB = FI;
+    if (!Region.count(BB))
+      continue;
+
+    for (llvm::BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E;
+         ++I) {
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+        llvm::Value *V = I->getOperand(i);
+
+        // A PHI uses its operand at the end of the incoming block.
+        if (llvm::PHINode *PN = llvm::dyn_cast<llvm::PHINode>(I))
+          if (!Region.count(PN->getIncomingBlock(i)))
+            continue;
+
+        if (llvm::Instruction *Def = llvm::dyn_cast<llvm::Instruction>(V)) {
+          if (Region.count(Def->getParent()))
+            continue;
+        } else if (!llvm::isa<llvm::Argument>(V)) {
+          continue;
+        }
+
+        if (!Seen.insert(V))
+          continue;
+
+        if (llvm::AllocaInst *AI = llvm::dyn_cast<llvm::AllocaInst>(V)) {
+          if (!AI->getAllocatedType()->isDoubleTy())
+            return false;
+        } else if (!V->getType()->isDoubleTy()) {
+          return false;
+        }
+        LiveIns.push_back(V);
+      }
+    }
+  }
+  return true;
+}
+
+/// RemoveUnreachableBlocks - Delete the blocks of F that its entry block can
+/// no longer reach.
+static void RemoveUnreachableBlocks(llvm::Function *F) {
+  llvm::SmallPtrSet<llvm::BasicBlock*, 32> Live;
+  CollectReachable(&F->getEntryBlock(), Live);
+
+  std::vector<llvm::BasicBlock*> Dead;
+  for (llvm::Function::iterator FI = F->begin(), FE = F->end(); FI != FE; ++FI)
+    if (!Live.count(FI))
+      Dead.push_back(FI);
+
+  for (unsigned i = 0, e = Dead.size(); i != e; ++i) {
+    llvm::BasicBlock *BB = Dead[i];
+    for (llvm::succ_iterator SI = llvm::succ_begin(BB), SE = llvm::succ_end(BB);
+         SI != SE; ++SI)
+      if (Live.count(*SI))
+        (*SI)->removePredecessor(BB);
+    BB->dropAllReferences();
+  }
+
+  for (unsigned i = 0, e = Dead.size(); i != e; ++i)
+    Dead[i]->eraseFromParent();
+}
+
+
+bool klang::CreateOSRContinuation(llvm::Function *F, llvm::BasicBlock *Header,
+                                  OSREntry &Entry) {
+  Entry.Header = Header;
+  Entry.LiveIns.clear();
+  Entry.Continuation = 0;
+
+  // The check goes in front of everything in Header, so a PHI there would
+  // lose its incoming edges.  Loop variables live in allocas, so unoptimized
+  // code has none.
+  if (llvm::isa<llvm::PHINode>(Header->begin()))
+    return false;
+
+  llvm::SmallPtrSet<llvm::BasicBlock*, 32> Region;
+  CollectReachable(Header, Region);
+  if (!CollectLiveIns(F, Region, Entry.LiveIns))
+    return false;
+
+  llvm::LLVMContext &Context = F->getContext();
+  llvm::Type *DoubleTy = llvm::Type::getDoubleTy(Context);
+  std::vector<llvm::Type*> Doubles(Entry.LiveIns.size(), DoubleTy);
+  llvm::Function *G = llvm::Function::Create(
+    llvm::FunctionType::get(DoubleTy, Doubles, false),
+    llvm::Function::InternalLinkage,
+    F->getName() + ".osr",
+    F->getParent());
+
+  // Arguments of F that are live into the loop become arguments of G, the
+  // others are dead past the entry block.
+  llvm::ValueToValueMapTy VMap;
+  llvm::Function::arg_iterator GI = G->arg_begin();
+  for (unsigned i = 0, e = Entry.LiveIns.size(); i != e; ++i, ++GI) {
+    GI->setName(Entry.LiveIns[i]->getName());
+    if (llvm::isa<llvm::Argument>(Entry.LiveIns[i]))
+      VMap[Entry.LiveIns[i]] = GI;
+  }
+  for (llvm::Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+       AI != AE; ++AI)
+    if (!VMap.count(AI))
+      VMap[AI] = llvm::UndefValue::get(AI->getType());
+
+  llvm::SmallVector<llvm::ReturnInst*, 4> Returns;
+  llvm::CloneFunctionInto(G, F, VMap, false, Returns);
+
+  // The new entry block keeps all variables, loads the incoming state into
+  // them, and jumps straight to the loop header.
+  llvm::BasicBlock *OldEntry = &G->getEntryBlock();
+  llvm::BasicBlock *NewEntry =
+    llvm::BasicBlock::Create(Context, "osr.entry", G, OldEntry);
+  llvm::Value *NewHeader = VMap[Header];
+  llvm::BranchInst *Br =
+    llvm::BranchInst::Create(llvm::cast<llvm::BasicBlock>(NewHeader), NewEntry);
+
+  for (llvm::BasicBlock::iterator I = OldEntry->begin(), E = OldEntry->end();
+       I != E; ) {
+    llvm::Instruction *Inst = I++;
+    if (llvm::isa<llvm::AllocaInst>(Inst))
+      Inst->moveBefore(Br);
+  }
+
+  llvm::IRBuilder<> B(Br);
+  GI = G->arg_begin();
+  for (unsigned i = 0, e = Entry.LiveIns.size(); i != e; ++i, ++GI) {
+    if (llvm::isa<llvm::Argument>(Entry.LiveIns[i]))
+      continue;
+    llvm::Value *NewV = VMap[Entry.LiveIns[i]];
+    if (llvm::AllocaInst *AI = llvm::dyn_cast<llvm::AllocaInst>(NewV))
+      B.CreateStore(GI, AI);
+    else
+      NewV->replaceAllUsesWith(GI);
+  }
+
+  RemoveUnreachableBlocks(G);
+
+  if (llvm::verifyFunction(*G, llvm::ReturnStatusAction)) {
+    G->eraseFromParent();
+    return false;
+  }
+
+  Entry.Continuation = G;
+  return true;
+}
+
+
+void klang::InsertOSRCheck(const OSREntry &Entry, llvm::GlobalVariable *Slot) {
+  llvm::BasicBlock *Header = Entry.Header;
+  llvm::Function *F = Header->getParent();
+  assert(!llvm::isa<llvm::PHINode>(Header->begin()) &&
+         "OSR check in front of a PHI");
+
+  // Header becomes the check; the original code moves to Header.body.  The
+  // back edge still targets Header, so the check runs on every iteration.
+  llvm::BasicBlock *Body =
+    Header->splitBasicBlock(Header->begin(), Header->getName() + ".body");
+  Header->getTerminator()->eraseFromParent();
+  llvm::BasicBlock *Enter =
+    llvm::BasicBlock::Create(F->getContext(), "osr.enter", F, Body);
+
+  llvm::IRBuilder<> B(Header);
+  llvm::Value *Target = B.CreateLoad(Slot, true, "osr.target");
+  B.CreateCondBr(B.CreateIsNotNull(Target, "osr.ready"), Enter, Body);
+
+  B.SetInsertPoint(Enter);
+  std::vector<llvm::Value*> Args;
+  for (unsigned i = 0, e = Entry.LiveIns.size(); i != e; ++i) {
+    llvm::Value *V = Entry.LiveIns[i];
+    if (llvm::isa<llvm::AllocaInst>(V))
+      V = B.CreateLoad(V, V->getName());
+    Args.push_back(V);
+  }
+  B.CreateRet(B.CreateCall(Target, Args, "osr.result"));
+}
@@ -12,8 +12,11 @@
 ///
 //===----------------------------------------------------------------------===//
 
-#include "klang/Driver/Driver.h"
 #include "klang/Lex/Lexer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
 
 using namespace klang;
 
@@ -98,6 +101,14 @@ Lexer::Lex(Token &Result) {
   // Otherwise, just return the character as its ascii value.
   int ThisChar = LastChar;
   LastChar = GetCharFromBuffer();
+
+  // '&&' and '||' are the builtin logical operators.  A single '&' or '|'
+  // is still free for a user-defined operator.
+  if ((ThisChar == '&' || ThisChar == '|') && LastChar == ThisChar) {
+    LastChar = GetCharFromBuffer();
+    Result.Kind = ThisChar == '&' ? tok::tok_andand : tok::tok_oror;
+    return;
+  }
   Result.Kind = ThisChar;
   return;
 }
@@ -106,16 +117,42 @@ Lexer::Lex(Token &Result) {
 int
 Lexer::GetCharFromBuffer(void)
 {
-  static int index = 0;
+  if (Index == Buffer.size() && Interactive && !ReadLine())
+    return KLANG_LEXER_EOF;
 
   //returns KLANG_LEXER_EOF for the character after the last one in the Buffer
-  return ((unsigned)(index+1) <= Buffer.size()) ?
-    (int)Buffer[index++] : KLANG_LEXER_EOF;
+  return (Index < Buffer.size()) ? (int)Buffer[Index++] : KLANG_LEXER_EOF;
+}
+
+bool
+Lexer::ReadLine()
+{
+  llvm::errs() << "ready> ";
+
+  Line.clear();
+  int C;
+  while ((C = getchar()) != EOF) {
+    Line += (char)C;
+    if (C == '\n')
+      break;
+  }
+  Buffer = Line;
+  Index = 0;
+
+  // Leave the terminal on a fresh line after ^D.
+  if (Line.empty())
+    llvm::errs() << "\n";
+  return !Line.empty();
 }
 
 
 Lexer::Lexer(llvm::StringRef _Buffer)
-  : LastChar(' '), Buffer(_Buffer)
+  : LastChar(' '), Buffer(_Buffer), Index(0), Interactive(false)
+{
+}
+
+Lexer::Lexer()
+  : LastChar(' '), Index(0), Interactive(true)
 {
 }
 
@@ -17,13 +17,14 @@
 using namespace klang;
 
 /// GetTokPrecedence - Get the precedence of the pending binary operator token.
-int Token::GetTokPrecedence() {
-  if (!isascii(Kind))
+int
+Token::GetTokPrecedence(const std::map<char, int> &BinopPrecedence) const {
+  if (!isascii(Kind) && Kind != tok::tok_andand && Kind != tok::tok_oror)
     return -1;
 
   // Make sure it's a declared binop.
-  int TokPrec = BinopPrecedence[Kind];
-  if (TokPrec <= 0) return -1;
-  return TokPrec;
+  std::map<char, int>::const_iterator I = BinopPrecedence.find(Kind);
+  if (I == BinopPrecedence.end() || I->second <= 0) return -1;
+  return I->second;
 }
 
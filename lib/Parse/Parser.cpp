@@ -12,10 +12,15 @@
 ///
 //===----------------------------------------------------------------------===//
 
-#include "klang/Driver/Driver.h"
 #include "klang/Driver/Utils.h"
+#include "klang/Frontend/CompilerInstance.h"
+#include "klang/JIT/BackgroundOptimizer.h"
+#include "klang/JIT/KlangJIT.h"
 #include "klang/Parse/Parser.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include <cstdio>
 
@@ -238,7 +243,7 @@ ExprAST *Parser::ParseUnary() {
 ExprAST *Parser::ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
   // If this is a binop, find its precedence.
   while (1) {
-    int TokPrec = Tok.GetTokPrecedence();
+    int TokPrec = Tok.GetTokPrecedence(CI.BinopPrecedence);
 
     // If this is a binop that binds at least as tightly as the current binop,
     // consume it, otherwise we are done.
@@ -255,7 +260,7 @@ ExprAST *Parser::ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
 
     // If BinOp binds less tightly with RHS than the operator after RHS, let
     // the pending operator take RHS as its LHS.
-    int NextPrec = Tok.GetTokPrecedence();
+    int NextPrec = Tok.GetTokPrecedence(CI.BinopPrecedence);
     if (TokPrec < NextPrec) {
       RHS = ParseBinOpRHS(TokPrec+1, RHS);
       if (RHS == 0) return 0;
@@ -378,14 +383,51 @@ PrototypeAST *Parser::ParseExtern() {
 // Top-Level parsing
 //===----------------------------------------------------------------------===//
 
+/// DiscardModule - Throw away the module of a top-level item that failed to
+/// generate.
+static void DiscardModule(CompilerInstance &CI) {
+  delete CI.TheFPM;
+  CI.TheFPM = 0;
+  delete CI.TheModule;
+  CI.TheModule = 0;
+}
+
+/// GetWallTime - The current wall clock time, in seconds.
+static double GetWallTime() {
+  return llvm::TimeRecord::getCurrentTime().getWallTime();
+}
+
+/// PrintMilliseconds - Print the time from Start to End, in milliseconds.
+static llvm::raw_ostream &PrintMilliseconds(llvm::raw_ostream &OS,
+                                            double Start, double End) {
+  return OS << llvm::format("%.3f ms", (End - Start) * 1000);
+}
+
 void Parser::HandleDefinition() {
   if (FunctionAST *F = ParseDefinition()) {
-    if (llvm::Function *LF = F->Codegen()) {
-      //FIXME
-      //IR dumping will be done via a new frontendaction emit-llvm
-      //llvm::errs() << "Read function definition:\n";
-      //LF->dump();
+    double Start = GetWallTime();
+    llvm::MutexGuard Locked(CI.CompilerLock);
+    CI.initializeModuleAndPassManager();
+    if (llvm::Function *LF = F->Codegen(CI)) {
+      // The JIT compiles the function on its first call, unless tiered
+      // execution compiles it right away.  In whole-program mode, it simply
+      // stays in the program module.
+      if (!CI.WholeProgram) {
+        if (!CI.TheOptimizer)
+          CI.optimizeModule(CI.TheModule);
+        CI.TheJIT->addModule(CI.TheModule);
+        if (CI.TheOptimizer)
+          CI.TheOptimizer->addFunction(LF);
+      }
+    } else if (!CI.WholeProgram) {
+      DiscardModule(CI);
     }
+
+    // The JIT only generates machine code on the first call, which counts
+    // towards the run time of the expression making it.
+    if (ReportTiming)
+      PrintMilliseconds(llvm::errs() << "compiled in ", Start, GetWallTime())
+        << "\n";
     //	if (ParseDefinition()) {}
     //		fprintf(stderr, "Parsed a function definition.\n");
   } else {
@@ -396,11 +438,19 @@ void Parser::HandleDefinition() {
 
 void Parser::HandleExtern() {
   if (PrototypeAST *P = ParseExtern()) {
-    if (llvm::Function *F = P->Codegen()) {
-      //FIXME
-      //IR dumping will be done via a new frontendaction emit-llvm
-      //llvm::errs() << "Read extern: \n";
-      //F->dump();
+    llvm::MutexGuard Locked(CI.CompilerLock);
+    // The declaration is emitted into the module of every item that uses it,
+    // so only the prototype needs to be kept.
+    if (P->CheckRedefinition(CI)) {
+      CI.FunctionProtos[P->getName()] = P;
+
+      // Calls made before the definition go through its stub as well.
+      if (CI.TheJIT && !CI.WholeProgram)
+        CI.TheJIT->declareFunction(P->getName(), CI.getContext());
+
+      // An operator defined in another file can be used once declared.
+      if (P->isBinaryOp())
+        CI.BinopPrecedence[P->getOperatorName()] = P->getBinaryPrecedence();
     }
     //	if (ParseExtern()) {}
     //		fprintf(stderr, "Parsed an extern\n");
@@ -413,24 +463,71 @@ void Parser::HandleExtern() {
 void Parser::HandleTopLevelExpression() {
   // Evaluate a top-level expression into an anonymous function.
   if (FunctionAST *F = ParseTopLevelExpr()) {
-    if (llvm::Function *LF = F->Codegen()) {
-      //fprintf(stderr, "Read top-level expression:");
-      //LF->dump();
+    if (CI.WholeProgram) {
+      // The expression runs once the whole program is compiled.
+      llvm::MutexGuard Locked(CI.CompilerLock);
+      CI.initializeModuleAndPassManager();
+      if (llvm::Function *LF = F->Codegen(CI))
+        TopLevelExprs.push_back(LF);
+      delete F;
+      return;
+    }
 
-      //------------------------------------------------
-      // JIT the function, returning a function pointer.
-      //------------------------------------------------
-      void *FPtr = TheExecutionEngine->getPointerToFunction(LF);
+    double Start = GetWallTime();
+    void *FPtr = 0;
+    KlangJIT::ModuleHandle H = 0;
+    {
+      // Hold the lock while compiling only; the background optimizer must be
+      // able to run while the expression executes.
+      llvm::MutexGuard Locked(CI.CompilerLock);
+      CI.initializeModuleAndPassManager();
+      if (llvm::Function *LF = F->Codegen(CI)) {
+        //fprintf(stderr, "Read top-level expression:");
+        //LF->dump();
+
+        if (!CI.TheOptimizer)
+          CI.optimizeModule(CI.TheModule);
+        H = CI.TheJIT->addModule(CI.TheModule);
+        if (CI.TheOptimizer)
+          CI.TheOptimizer->addFunction(LF);
+
+        //------------------------------------------------
+        // JIT the function, returning a function pointer.
+        //------------------------------------------------
+        FPtr = CI.TheJIT->getPointerToFunction(LF);
+      } else {
+        DiscardModule(CI);
+      }
+    }
 
+    if (FPtr) {
       //------------------------------------------------
       // Cast it to the right type (takes no arguments, returns a double) so we
       // can call it as a native function.
       //------------------------------------------------
       double (*FP)() = (double (*)())(intptr_t)FPtr;
 
+      double Compiled = GetWallTime();
       double Result = FP();
+      double Ran = GetWallTime();
       llvm::errs() << "\nEvaluated to " << Result << "\n";
+      if (ReportTiming) {
+        PrintMilliseconds(llvm::errs() << "compiled in ", Start, Compiled);
+        PrintMilliseconds(llvm::errs() << ", ran in ", Compiled, Ran) << "\n";
+      }
+
+      // The expression never runs again, so free its machine code and IR
+      // right away.  Long sessions would grow without bound otherwise.
+      llvm::MutexGuard Locked(CI.CompilerLock);
+      if (CI.TheOptimizer)
+        CI.TheOptimizer->forgetModule(H);
+      CI.TheJIT->removeModule(H);
+      delete CI.TheFPM;
+      CI.TheFPM = 0;
+      CI.TheModule = 0;
     }
+
+    delete F;
     //	if (ParseTopLevelExpr()) {}
     //		fprintf(stderr, "Parsed a top-level expr\n");
   } else {
@@ -443,18 +540,11 @@ void Parser::HandleTopLevelExpression() {
 /// top ::= definition | external | expression | ';'
 void Parser::Go() {
 
-  // Prime the first token.
-  //FIXME
-  //User prompt will appear in case of interactive mode which will be
-  //implemented soon
-  //llvm::errs() << "ready> \n";
+  // Prime the first token.  An interactive lexer prompts for each line
+  // itself, as tokens are needed.
   GetNextToken();
 
   while (1) {
-    //FIXME
-    //User prompt will appear in case of interactive mode which will be
-    //implemented soon
-    //llvm::errs() << "ready> \n";
     switch (Tok.Kind) {
     case tok::tok_eof:
       return;
@@ -12,26 +12,46 @@
 //===----------------------------------------------------------------------===//
 
 #include "klang/AST/ASTNodes.h"
+#include "klang/Builtin/Memo.h"
 #include "klang/Builtin/Tutorial.h"
+#include "klang/CodeGen/BackendUtil.h"
+#include "klang/CodeGen/DependencyGraph.h"
+#include "klang/CodeGen/OptimizationCache.h"
+#include "klang/CodeGen/ParallelOptimizer.h"
+#include "klang/Frontend/CompilerInstance.h"
+#include "klang/Frontend/CompilerServer.h"
+#include "klang/Frontend/FrontendUtil.h"
+#include "klang/Frontend/Prelude.h"
+#include "klang/JIT/BackgroundOptimizer.h"
+#include "klang/JIT/KlangJIT.h"
 #include "klang/Lex/Lexer.h"
 #include "klang/Parse/Parser.h"
 
 #include "llvm/ADT/OwningPtr.h"
-#include "llvm/Analysis/Passes.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JIT.h"
 #include "llvm/IR/DataLayout.h"
-#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
-#include "llvm/PassManager.h"
+#include "llvm/Linker.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/PathV2.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/system_error.h"
-#include "llvm/Transforms/Scalar.h"
+#include "llvm/Target/TargetMachine.h"
 
-#include <map>
+#include <algorithm>
 #include <string>
 
 
@@ -39,102 +59,663 @@
 // Main driver code.
 //===----------------------------------------------------------------------===//
 
-namespace klang {
-
-  std::map<char, int> Token::BinopPrecedence;
+namespace {
+  llvm::cl::opt<std::string>
+    OutputFilename("o",
+                   llvm::cl::desc("Write the output to <filename>.  With "
+                                  "no action, compile the program into an "
+                                  "object file (*.o) or an executable"),
+                   llvm::cl::value_desc("filename"));
 
-  llvm::Module *TheModule;
-  llvm::IRBuilder<> Builder(llvm::getGlobalContext());
-  std::map<std::string, llvm::AllocaInst*> NamedValues;
+  llvm::cl::opt<int>
+    OptLevel("O",
+             llvm::cl::desc("Optimization level [-O0, -O1, -O2 or -O3]. "
+                            "Without it each function gets the classic "
+                            "tutorial pipeline"),
+             llvm::cl::Prefix,
+             llvm::cl::ZeroOrMore,
+             llvm::cl::init(-1));
+
+  llvm::cl::opt<klang::BackendAction>
+    Action(llvm::cl::desc("Compile the program ahead of time and write:"),
+           llvm::cl::init(klang::Backend_EmitNothing),
+           llvm::cl::values(
+             clEnumValN(klang::Backend_EmitLL, "emit-llvm",
+                        "LLVM assembly (.ll)"),
+             clEnumValN(klang::Backend_EmitBC, "emit-bc",
+                        "LLVM bitcode (.bc)"),
+             clEnumValN(klang::Backend_EmitAssembly, "S",
+                        "Native assembly (.s)"),
+             clEnumValN(klang::Backend_EmitObj, "c",
+                        "A native object file (.o)"),
+             clEnumValEnd));
+
+  llvm::cl::list<std::string>
+    InputFilenames(llvm::cl::Positional,
+                   llvm::cl::desc("<input files>"),
+                   llvm::cl::ZeroOrMore);
+
+  llvm::cl::opt<bool>
+    Tiered("tiered",
+           llvm::cl::desc("Run unoptimized code at once and optimize it in "
+                          "the background"));
 
-  llvm::FunctionPassManager *TheFPM;
-  llvm::ExecutionEngine *TheExecutionEngine;
-}
+  llvm::cl::opt<std::string>
+    CacheDir("cache-dir",
+             llvm::cl::desc("Cache optimized functions in <directory>; "
+                            "code inlined across functions is only reused "
+                            "when running in the JIT"),
+             llvm::cl::value_desc("directory"));
+
+  llvm::cl::opt<bool>
+    CacheStats("cache-stats",
+               llvm::cl::desc("Print optimization cache statistics on exit"));
+
+  llvm::cl::opt<bool>
+    WholeProgramFlag("whole-program",
+                     llvm::cl::desc("Compile the whole input before running "
+                                    "it, and optimize it as one program"));
+
+  llvm::cl::opt<unsigned>
+    Threads("j",
+            llvm::cl::desc("Optimize the functions of a whole program on <N> "
+                           "threads"),
+            llvm::cl::value_desc("N"),
+            llvm::cl::init(1));
+
+  llvm::cl::opt<bool>
+    DiscardIR("discard-ir",
+              llvm::cl::desc("Keep only a bitcode summary of the functions "
+                             "the JIT has compiled"));
 
+  llvm::cl::opt<std::string>
+    Serve("serve",
+          llvm::cl::desc("Stay up and run the programs sent to <socket>, "
+                         "with the input files compiled in beforehand"),
+          llvm::cl::value_desc("socket"));
 
-namespace {
   llvm::cl::opt<std::string>
-    OutputFilename("o",
-                   llvm::cl::desc("Specify output filename"),
-                   llvm::cl::value_desc("filename"));
+    Connect("connect",
+            llvm::cl::desc("Have the server at <socket> run the input "
+                           "instead of starting a compiler"),
+            llvm::cl::value_desc("socket"));
+
+  llvm::cl::opt<bool>
+    AllowRedefinition("allow-redefinition",
+                      llvm::cl::desc("Let a definition replace an earlier "
+                                     "one of the same name.  Always on at "
+                                     "the interactive prompt"));
+
+  llvm::cl::list<std::string>
+    IncludePCH("include-pch",
+               llvm::cl::desc("Start out with the functions and operators "
+                              "of the precompiled module <file>"),
+               llvm::cl::value_desc("file"));
+
+  llvm::cl::alias
+    IncludePrelude("prelude",
+                   llvm::cl::desc("Alias for -include-pch"),
+                   llvm::cl::aliasopt(IncludePCH));
+
+  llvm::cl::opt<bool>
+    EmitPCH("emit-pch",
+            llvm::cl::desc("Compile the input into a precompiled module "
+                           "(*.kpch) for -include-pch, with no main"));
+
+  llvm::cl::alias
+    EmitPrelude("emit-prelude",
+                llvm::cl::desc("Alias for -emit-pch"),
+                llvm::cl::aliasopt(EmitPCH));
 
   llvm::cl::opt<std::string>
-    InputFilename(llvm::cl::Positional,
-                  llvm::cl::desc("<input file>"),
-                  llvm::cl::init("-"));
+    SaveSession("save-session",
+                llvm::cl::desc("On exit, save the definitions of the "
+                               "session as a precompiled module <file> for "
+                               "-include-pch"),
+                llvm::cl::value_desc("file"));
+
+  llvm::cl::opt<bool>
+    Memoize("memoize",
+            llvm::cl::desc("Remember the results of functions without side "
+                           "effects, in a bounded table per function"));
+
+  llvm::cl::opt<bool>
+    TimeItems("time-items",
+              llvm::cl::desc("Print how long each item took to compile and "
+                             "run"));
+}
+
+
+/// LinkExecutable - Link Object with the builtin runtime into the executable
+/// OutputFilename.  The runtime is installed as lib/libklangBuiltin.a next to
+/// the bin directory of the driver.
+static bool LinkExecutable(const char *Argv0, const std::string &Object,
+                           std::string &ErrStr) {
+  llvm::sys::Path CC = llvm::sys::Program::FindProgramByName("cc");
+  if (CC.isEmpty()) {
+    ErrStr = "unable to find 'cc' in PATH";
+    return false;
+  }
+
+  llvm::sys::Path Runtime = llvm::sys::Path::GetMainExecutable(
+    Argv0, (void *)(intptr_t)LinkExecutable);
+  Runtime.eraseComponent();
+  Runtime.eraseComponent();
+  Runtime.appendComponent("lib");
+  Runtime.appendComponent("libklangBuiltin.a");
+
+  const char *Args[] = {
+    CC.c_str(), Object.c_str(), Runtime.c_str(), "-lm",
+    "-o", OutputFilename.c_str(), 0
+  };
+  if (llvm::sys::Program::ExecuteAndWait(CC, Args, 0, 0, 0, 0, &ErrStr)) {
+    if (ErrStr.empty())
+      ErrStr = "linker command failed";
+    return false;
+  }
+  return true;
+}
+
+/// GetOutputFilename - Return the file Act writes to: the -o file, or the
+/// first input file renamed after the kind of output.
+static std::string GetOutputFilename(klang::BackendAction Act) {
+  if (!OutputFilename.empty())
+    return OutputFilename;
+  if (InputFilenames[0] == "-")
+    return "-";
+
+  const char *Ext = "o";
+  switch (Act) {
+  case klang::Backend_EmitAssembly: Ext = "s"; break;
+  case klang::Backend_EmitBC: Ext = "bc"; break;
+  case klang::Backend_EmitLL: Ext = "ll"; break;
+  case klang::Backend_EmitNothing:
+  case klang::Backend_EmitObj: break;
+  }
+  if (EmitPCH)
+    Ext = "kpch";
+
+  llvm::SmallString<128> Path(llvm::sys::path::filename(InputFilenames[0]));
+  llvm::sys::path::replace_extension(Path, Ext);
+  return Path.str();
+}
+
+/// WriteOutput - Write the program module to Filename as Act says.
+static bool WriteOutput(klang::CompilerInstance &CI, klang::BackendAction Act,
+                        const std::string &Filename, std::string &ErrStr) {
+  unsigned Flags = 0;
+  if (Act == klang::Backend_EmitBC || Act == klang::Backend_EmitObj)
+    Flags = llvm::raw_fd_ostream::F_Binary;
+
+  llvm::tool_output_file Out(Filename.c_str(), ErrStr, Flags);
+  if (!ErrStr.empty())
+    return false;
+  if (!klang::EmitBackendOutput(CI.TheModule, *CI.TheTarget, Act, Out.os(),
+                                ErrStr))
+    return false;
+  Out.keep();
+  return true;
+}
+
+/// WriteExecutable - Compile the program module into a temporary object
+/// file and link it into OutputFilename.
+static bool WriteExecutable(klang::CompilerInstance &CI, const char *Argv0,
+                            std::string &ErrStr) {
+  int FD;
+  llvm::SmallString<128> ObjectPath;
+  if (llvm::error_code EC = llvm::sys::fs::unique_file(
+        OutputFilename + "-%%%%%%.o", FD, ObjectPath)) {
+    ErrStr = EC.message();
+    return false;
+  }
+
+  bool Success;
+  {
+    llvm::raw_fd_ostream Out(FD, true);
+    Success = klang::EmitBackendOutput(CI.TheModule, *CI.TheTarget,
+                                       klang::Backend_EmitObj, Out, ErrStr);
+  }
+  if (Success)
+    Success = LinkExecutable(Argv0, ObjectPath.str(), ErrStr);
+
+  bool Existed;
+  llvm::sys::fs::remove(ObjectPath.str(), Existed);
+  return Success;
+}
+
+/// WriteProgram - Write out the program compiled ahead of time.  Without an
+/// explicit action, -o names an object file if it ends in .o and an
+/// executable otherwise.
+static bool WriteProgram(klang::CompilerInstance &CI, const char *Argv0,
+                         const std::vector<llvm::Function*> &Exprs,
+                         std::string &ErrStr) {
+  if (CI.TheParallelOptimizer)
+    CI.TheParallelOptimizer->join();
+
+  // An empty program still gets a main.
+  CI.initializeModuleAndPassManager();
+  if (!klang::EmitMainFunction(CI.TheModule, Exprs, ErrStr))
+    return false;
+
+  klang::BackendAction Act = Action;
+  bool Executable = Act == klang::Backend_EmitNothing &&
+                    !llvm::StringRef(OutputFilename).endswith(".o");
+  if (Act == klang::Backend_EmitNothing && !Executable)
+    Act = klang::Backend_EmitObj;
+
+  // Only an executable is complete.  Anything else may be linked against,
+  // so the functions defined by the program stay visible.
+  std::vector<const char*> EntryPoints(1, "main");
+  if (!Executable)
+    for (llvm::Module::iterator F = CI.TheModule->begin(),
+         E = CI.TheModule->end(); F != E; ++F)
+      if (!F->isDeclaration() && F->hasExternalLinkage() && F->hasName())
+        EntryPoints.push_back(F->getName().data());
+  CI.optimizeProgram(CI.TheModule, EntryPoints);
+
+  if (Executable)
+    return WriteExecutable(CI, Argv0, ErrStr);
+  return WriteOutput(CI, Act, GetOutputFilename(Act), ErrStr);
+}
+
+/// WritePrelude - Write out the program module as a precompiled module: its
+/// bitcode, with the operator precedences.  Its functions stay external, for
+/// the programs that include it.
+static bool WritePrelude(klang::CompilerInstance &CI,
+                         const std::vector<llvm::Function*> &Exprs,
+                         std::string &ErrStr) {
+  if (!Exprs.empty()) {
+    ErrStr = "a prelude cannot have top-level expressions";
+    return false;
+  }
+  if (CI.TheParallelOptimizer)
+    CI.TheParallelOptimizer->join();
+
+  CI.initializeModuleAndPassManager();
+  CI.optimizeModule(CI.TheModule);
+  klang::RecordOperators(CI, CI.TheModule);
+  klang::RecordPurity(CI, CI.TheModule);
+  return WriteOutput(CI, klang::Backend_EmitBC,
+                     GetOutputFilename(klang::Backend_EmitBC), ErrStr);
+}
+
+/// LinkPrelude - Link Prelude into the program module, once the functions of
+/// the program are final.  Whatever the program does not use goes with its
+/// internalization.
+static bool LinkPrelude(klang::CompilerInstance &CI, llvm::Module *Prelude,
+                        std::string &ErrStr) {
+  if (CI.TheParallelOptimizer)
+    CI.TheParallelOptimizer->join();
+
+  CI.initializeModuleAndPassManager();
+  CI.Libraries.erase(std::remove(CI.Libraries.begin(), CI.Libraries.end(),
+                                 Prelude),
+                     CI.Libraries.end());
+  CI.LibraryBitcode.erase(Prelude);
+  return !llvm::Linker::LinkModules(CI.TheModule, Prelude,
+                                    llvm::Linker::DestroySource, &ErrStr);
+}
+
+/// SaveSnapshot - Write the definitions of the JIT session to SaveSession,
+/// like a module written by -emit-pch.  A later session includes it to start
+/// out where this one left off, without compiling anything up front.
+static bool SaveSnapshot(klang::CompilerInstance &CI, std::string &ErrStr) {
+  llvm::OwningPtr<llvm::Module> Snapshot(
+    CI.TheJIT->createSnapshot(CI.getContext()));
+  klang::RecordOperators(CI, Snapshot.get());
+  klang::RecordPurity(CI, Snapshot.get());
+
+  llvm::tool_output_file Out(SaveSession.c_str(), ErrStr,
+                             llvm::raw_fd_ostream::F_Binary);
+  if (!ErrStr.empty())
+    return false;
+  llvm::WriteBitcodeToFile(Snapshot.get(), Out.os());
+  Out.keep();
+  return true;
+}
+
+/// RunProgram - Optimize the program module as a whole, JIT it, and run its
+/// top-level expressions Exprs in order.
+static void RunProgram(klang::CompilerInstance &CI,
+                       const std::vector<llvm::Function*> &Exprs) {
+  if (CI.TheParallelOptimizer)
+    CI.TheParallelOptimizer->join();
+  CI.initializeModuleAndPassManager();
+
+  // The expressions are the entry points, so they need names to survive
+  // internalization.
+  std::vector<std::string> Names;
+  for (unsigned i = 0, e = Exprs.size(); i != e; ++i) {
+    Exprs[i]->setName("__klang_expr");
+    Names.push_back(Exprs[i]->getName());
+  }
+  std::vector<const char*> EntryPoints;
+  for (unsigned i = 0, e = Names.size(); i != e; ++i)
+    EntryPoints.push_back(Names[i].c_str());
+
+  CI.optimizeProgram(CI.TheModule, EntryPoints);
+  CI.TheJIT->addModule(CI.TheModule);
+
+  for (unsigned i = 0, e = Exprs.size(); i != e; ++i) {
+    double (*FP)() =
+      (double (*)())(intptr_t)CI.TheJIT->getPointerToFunction(Exprs[i]);
+    double Result = FP();
+    llvm::errs() << "\nEvaluated to " << Result << "\n";
+  }
 }
 
 
 int main(int argc, char* const argv[]) {
 
   llvm::cl::ParseCommandLineOptions(argc, argv);
+  if (OptLevel < -1 || OptLevel > 3) {
+    llvm::errs() << "klang: invalid optimization level -O" << OptLevel
+      << "\n";
+    return 1;
+  }
 
-  llvm::OwningPtr<llvm::MemoryBuffer> Buf;
+  // A server runs its programs in the JIT as they come; its input files
+  // are preludes, and optional.
+  bool Serving = !Serve.empty();
+  if (Serving && (!OutputFilename.empty() ||
+                  Action != klang::Backend_EmitNothing || EmitPCH ||
+                  WholeProgramFlag || Tiered)) {
+    llvm::errs() << "klang: -serve cannot be combined with ahead-of-time "
+      "compilation, -whole-program or -tiered\n";
+    return 1;
+  }
 
-  if (llvm::MemoryBuffer::getFileOrSTDIN(InputFilename, Buf))
+  if (!SaveSession.empty() &&
+      (Serving || !OutputFilename.empty() ||
+       Action != klang::Backend_EmitNothing || EmitPCH || WholeProgramFlag ||
+       Tiered || Memoize || InputFilenames.size() > 1)) {
+    llvm::errs() << "klang: -save-session needs a JIT session of one input, "
+      "without -whole-program, -tiered or -memoize\n";
     return 1;
+  }
 
-  llvm::InitializeNativeTarget();
-  llvm::LLVMContext &Context = llvm::getGlobalContext();
+  if (Memoize && Tiered) {
+    llvm::errs() << "klang: -memoize cannot be combined with -tiered\n";
+    return 1;
+  }
 
-  klang::Lexer myLexer(Buf->getBuffer());
-  klang::Parser myParser(myLexer);
+  // A whole program is optimized once, before it runs, so there is no tier
+  // to start in.
+  if (Tiered && (!OutputFilename.empty() ||
+                 Action != klang::Backend_EmitNothing || EmitPCH ||
+                 WholeProgramFlag || InputFilenames.size() > 1)) {
+    llvm::errs() << "klang: -tiered needs a JIT session of one input, "
+      "without -whole-program\n";
+    return 1;
+  }
+
+  // Only the functions of a single whole program are spread over threads.
+  // The JIT optimizes each item as it comes, and several files already get
+  // a thread each.
+  if (Threads > 1 &&
+      (Serving || !Connect.empty() || InputFilenames.size() > 1 ||
+       (OutputFilename.empty() && Action == klang::Backend_EmitNothing &&
+        !EmitPCH && !WholeProgramFlag))) {
+    llvm::errs() << "klang: -j needs a whole program of one input, compiled "
+      "ahead of time or with -whole-program\n";
+    return 1;
+  }
+
+  if (InputFilenames.empty() && !Serving)
+    InputFilenames.push_back("-");
+
+  // A user typing at a terminal gets a prompt, and each item is compiled
+  // and run as soon as it is entered instead of once the input ends.
+  bool Interactive =
+    !Serving && Connect.empty() && OutputFilename.empty() &&
+    Action == klang::Backend_EmitNothing && !EmitPCH &&
+    !WholeProgramFlag &&
+    InputFilenames.size() == 1 && InputFilenames[0] == "-" &&
+    llvm::sys::Process::StandardInIsUserInput();
+
+  std::vector<llvm::MemoryBuffer*> Inputs;
+  for (unsigned i = 0, e = Interactive ? 0 : InputFilenames.size(); i != e;
+       ++i) {
+    llvm::OwningPtr<llvm::MemoryBuffer> Buf;
+    if (llvm::MemoryBuffer::getFileOrSTDIN(InputFilenames[i], Buf)) {
+      llvm::DeleteContainerPointers(Inputs);
+      return 1;
+    }
+    Inputs.push_back(Buf.take());
+  }
+
+  // The client leaves everything to the server, which is already set up.
+  if (!Connect.empty()) {
+    std::string Source;
+    for (unsigned i = 0, e = Inputs.size(); i != e; ++i)
+      Source += Inputs[i]->getBuffer();
+    llvm::DeleteContainerPointers(Inputs);
+
+    std::string ErrStr;
+    if (!klang::RunClient(Connect, Source, ErrStr)) {
+      llvm::errs() << "klang: " << ErrStr << "\n";
+      return 1;
+    }
+    return 0;
+  }
 
-  // Install standard binary operators.
-  // 1 is lowest precedence.
-  klang::Token::BinopPrecedence['='] = 2;
-  klang::Token::BinopPrecedence['<'] = 10;
-  klang::Token::BinopPrecedence['+'] = 20;
-  klang::Token::BinopPrecedence['-'] = 20;
-  klang::Token::BinopPrecedence['*'] = 40;  // highest.
+  // Several files are compiled on threads of their own and linked into one
+  // program.
+  bool MultipleFiles = Inputs.size() > 1 && !Serving;
 
-  // Make the module, which holds all the code.
-  klang::TheModule = new llvm::Module("my cool jit", Context);
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  // Everything below is torn down before CI, whose context holds the IR.
+  klang::CompilerInstance CI;
+  CI.OptLevel = OptLevel;
+  CI.Memoize = Memoize;
+
+  // Memoized functions call into the runtime, which the JIT has to find in
+  // the driver itself.
+  if (Memoize) {
+    llvm::sys::DynamicLibrary::AddSymbol("klang_memo_lookup",
+                                         (void *)klang_memo_lookup);
+    llvm::sys::DynamicLibrary::AddSymbol("klang_memo_store",
+                                         (void *)klang_memo_store);
+  }
 
-  //-----------------------------------------------------
-  // Create the JIT.  This takes ownership of the module.
   std::string ErrStr;
-  klang::TheExecutionEngine =
-    llvm::EngineBuilder(klang::TheModule).setErrorStr(&ErrStr).create();
-  if (!klang::TheExecutionEngine) {
-    llvm::errs() << "Could not create ExecutionEngine: " << ErrStr.c_str()
-      << "\n";
-    exit(1);
-  }
-
-  llvm::FunctionPassManager OurFPM(klang::TheModule);
-
-  // Set up the optimizer pipeline.  Start with registering info about how the
-  // target lays out data structures.
-  OurFPM.add(new llvm::DataLayout(*klang::TheExecutionEngine->getDataLayout()));
-  // Provide basic AliasAnalysis support for GVN.
-  OurFPM.add(llvm::createBasicAliasAnalysisPass());
-  // Promote allocas to registers.
-  OurFPM.add(llvm::createPromoteMemoryToRegisterPass());
-  // Do simple "peephole" optimizations and bit-twiddling optzns.
-  OurFPM.add(llvm::createInstructionCombiningPass());
-  // Reassociate expressions.
-  OurFPM.add(llvm::createReassociatePass());
-  // Eliminate Common SubExpressions.
-  OurFPM.add(llvm::createGVNPass());
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  OurFPM.add(llvm::createCFGSimplificationPass());
-
-  OurFPM.doInitialization();
-
-  // Set the global so the code gen can use this.
-  klang::TheFPM = &OurFPM;
-  //-----------------------------------------------------
-
-  // Run the main "interpreter loop" now.
-  myParser.Go();
-
-  klang::TheFPM = 0;
-
-  // Print out all of the generated code.
-  //FIXME
-  //IR dumping will be done via a new frontendaction emit-llvm
-  //klang::TheModule->dump();
+  llvm::OwningPtr<klang::KlangJIT> JIT;
+  llvm::OwningPtr<llvm::TargetMachine> Target;
+  if (!OutputFilename.empty() || Action != klang::Backend_EmitNothing ||
+      EmitPCH) {
+    // Compile ahead of time: the whole program goes into one module, which
+    // is written out instead of run.
+    Target.reset(klang::CreateHostTargetMachine(ErrStr));
+    if (!Target.get()) {
+      llvm::errs() << "Could not create TargetMachine: " << ErrStr << "\n";
+      exit(1);
+    }
+    CI.TheTarget = Target.get();
+    CI.WholeProgram = true;
+  } else {
+    //-----------------------------------------------------
+    // Create the JIT.  Every top-level item gets a module of its own, which
+    // the parser hands over to it.
+    JIT.reset(klang::KlangJIT::create(CI.getContext(), ErrStr));
+    if (!JIT.get()) {
+      llvm::errs() << "Could not create ExecutionEngine: " << ErrStr.c_str()
+        << "\n";
+      exit(1);
+    }
+
+    // Hand the JIT to the compiler instance so the code gen can use it.
+    CI.TheJIT = JIT.get();
+    CI.TheTarget = &JIT->getTargetMachine();
+    JIT->setDiscardIR(DiscardIR);
+    CI.WholeProgram = WholeProgramFlag || MultipleFiles;
+
+    // Calls between items go through stubs a new definition can take over.
+    JIT->setRedefinable((AllowRedefinition || Interactive) &&
+                        !CI.WholeProgram);
+    //-----------------------------------------------------
+  }
+
+  // Precompiled modules are mapped into memory, and a body is only read
+  // from one when needed: the JIT takes it on first call, a whole program
+  // takes those it uses.
+  std::vector<llvm::Module*> Preludes;
+  for (unsigned i = 0, e = IncludePCH.size(); i != e; ++i) {
+    llvm::OwningPtr<llvm::MemoryBuffer> Buf;
+    llvm::Module *Prelude = 0;
+    if (llvm::error_code EC =
+          llvm::MemoryBuffer::getFile(IncludePCH[i], Buf, -1, false))
+      ErrStr = EC.message();
+    else
+      Prelude = klang::LoadPrelude(CI, Buf.take(), ErrStr);
+    if (!Prelude) {
+      llvm::errs() << "klang: " << IncludePCH[i] << ": " << ErrStr << "\n";
+      llvm::DeleteContainerPointers(Inputs);
+      llvm::DeleteContainerPointers(Preludes);
+      return 1;
+    }
+
+    if (CI.WholeProgram)
+      Preludes.push_back(Prelude);
+    else
+      CI.TheJIT->addLibrary(Prelude);
+  }
+
+  // Cached functions are keyed on their IR and on everything else that
+  // shapes the optimized code.  Bump the pipeline version whenever
+  // createFunctionPassManager changes.  From -O2 on, library bodies are
+  // inlined into the program, so the libraries count too.
+  llvm::OwningPtr<klang::OptimizationCache> Cache;
+  if (!CacheDir.empty()) {
+    std::string Context = "fpm-1 O";
+    Context += llvm::itostr(CI.OptLevel);
+    Context += " ";
+    Context += CI.TheTarget->getTargetTriple();
+    Context += " ";
+    Context += CI.TheTarget->getTargetCPU();
+    Context += " ";
+    Context += CI.TheTarget->getDataLayout()->getStringRepresentation();
+    for (unsigned i = 0, e = CI.Libraries.size(); i != e; ++i) {
+      Context += " lib-";
+      Context += klang::OptimizationCache::hashData(
+        CI.LibraryBitcode[CI.Libraries[i]]);
+    }
+    Cache.reset(new klang::OptimizationCache(CacheDir, Context));
+    CI.TheCache = Cache.get();
+  }
+
+  // The module pipeline inlines across functions, so its results are cached
+  // along with what each function depends on.  A whole program is optimized
+  // as one module, which is not cached; only the JIT reuses this code.
+  llvm::OwningPtr<klang::DependencyGraph> Deps;
+  llvm::SmallString<128> DepsPath(CacheDir);
+  if (Cache.get() && !CI.WholeProgram) {
+    llvm::sys::path::append(DepsPath, "deps");
+    Deps.reset(new klang::DependencyGraph());
+    Deps->load(DepsPath);
+    CI.TheDeps = Deps.get();
+  }
+
+  // Functions only have to be optimized by the time a whole program is
+  // complete, so they can wait for a free thread.  Several files are
+  // already optimized in parallel, one per thread.
+  llvm::OwningPtr<klang::ParallelOptimizer> Pool;
+  if (CI.WholeProgram && Threads > 1 && !MultipleFiles) {
+    llvm::llvm_start_multithreaded();
+    Pool.reset(new klang::ParallelOptimizer(CI, Threads, Cache.get()));
+    CI.TheParallelOptimizer = Pool.get();
+  }
+
+  // Under tiered execution the optimizer pipeline runs on a worker thread.
+  // A whole program is only optimized once it is complete.
+  llvm::OwningPtr<klang::BackgroundOptimizer> Optimizer;
+  if (Tiered && !CI.WholeProgram) {
+    llvm::llvm_start_multithreaded();
+    Optimizer.reset(new klang::BackgroundOptimizer(CI));
+    Optimizer->start();
+    CI.TheOptimizer = Optimizer.get();
+  }
+
+  std::vector<llvm::Function*> Exprs;
+  bool Linked = true;
+  if (MultipleFiles) {
+    llvm::llvm_start_multithreaded();
+    Linked = klang::CompileFiles(CI, Inputs, Exprs, ErrStr);
+  } else if (Serving) {
+    // The preludes go into the state every program starts out with.
+    for (unsigned i = 0, e = Inputs.size(); i != e; ++i) {
+      klang::Lexer PreludeLexer(Inputs[i]->getBuffer());
+      klang::Parser PreludeParser(CI, PreludeLexer);
+      PreludeParser.setReportTiming(TimeItems);
+      PreludeParser.Go();
+    }
+    llvm::DeleteContainerPointers(Inputs);
+
+    klang::RunServer(CI, Serve, ErrStr);
+    llvm::errs() << "klang: " << ErrStr << "\n";
+    return 1;
+  } else if (Interactive) {
+    klang::Lexer myLexer;
+    klang::Parser myParser(CI, myLexer);
+    myParser.setReportTiming(TimeItems);
+    myParser.Go();
+  } else {
+    // Run the main "interpreter loop" now.
+    klang::Lexer myLexer(Inputs[0]->getBuffer());
+    klang::Parser myParser(CI, myLexer);
+    myParser.setReportTiming(TimeItems);
+    myParser.Go();
+    Exprs = myParser.getTopLevelExprs();
+  }
+  llvm::DeleteContainerPointers(Inputs);
+  for (unsigned i = 0, e = Preludes.size(); i != e; ++i)
+    if (Linked)
+      Linked = LinkPrelude(CI, Preludes[i], ErrStr);
+  llvm::DeleteContainerPointers(Preludes);
+  if (!Linked) {
+    llvm::errs() << "klang: " << ErrStr << "\n";
+    return 1;
+  }
+
+  if (Optimizer.get())
+    Optimizer->stop();
+  CI.TheOptimizer = 0;
+
+  bool Failed = false;
+  if (Target.get() && EmitPCH)
+    Failed = !WritePrelude(CI, Exprs, ErrStr);
+  else if (Target.get())
+    Failed = !WriteProgram(CI, argv[0], Exprs, ErrStr);
+  if (JIT.get() && CI.WholeProgram)
+    RunProgram(CI, Exprs);
+  if (!SaveSession.empty() && !SaveSnapshot(CI, ErrStr))
+    llvm::errs() << "klang: " << SaveSession << ": " << ErrStr << "\n";
+  Pool.reset();
+  CI.TheParallelOptimizer = 0;
+  delete CI.TheFPM;
+  CI.TheFPM = 0;
+
+  if (Cache.get() && CacheStats)
+    Cache->printStats(llvm::errs());
+  CI.TheCache = 0;
+  if (Deps.get()) {
+    Deps->save(DepsPath);
+    if (CacheStats)
+      Deps->printStats(llvm::errs());
+  }
+  CI.TheDeps = 0;
+
+  if (Target.get()) {
+    // Unlike the modules of the JIT, the program module is ours.
+    delete CI.TheModule;
+    CI.TheModule = 0;
+    if (Failed) {
+      llvm::errs() << "klang: " << ErrStr << "\n";
+      return 1;
+    }
+    return 0;
+  }
 
   // Calls an unused function just not to lose it in the final binary
   // Without this call klangBuiltin.a is just ignored during linking